@@ -0,0 +1,55 @@
+
+#ifndef FAST_BLEUALIGN_BENCH_COMMON_H
+#define FAST_BLEUALIGN_BENCH_COMMON_H
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+    // Sentences of the file given on the command line, one per line, or a few
+    // sample sentences repeated when there is none
+    inline std::vector<std::string> LoadSentences(int argc, char *argv[], size_t repeat = 2000) {
+      std::vector<std::string> sentences;
+      if (argc > 1) {
+        std::ifstream in(argv[1]);
+        std::string line;
+        while (std::getline(in, line))
+          sentences.push_back(line);
+        return sentences;
+      }
+
+      const std::vector<std::string> samples = {
+              "More than three million Albanians 123-123 living outside Albania, the majority of them (about 2.5 million) in Kosovo.",
+              "BOEING 777-200 - 280 SEATS.Characteristics Length in meters: 63.70 Wingspan in meters: 60.90 Cruising speed: Mach .84",
+              "During the Turkish rule were about 70% of the Albanians to Islam about 20% were Orthodox and Catholics almost 10%.",
+              "You are here: Home \xc2\xbb Country and People \xc2\xbb The Albanian People deutsch|english|shqip",
+              "Skip to the content.",
+              "With friends and guests to share them if necessary their last piece of bread.",
+              "In the hard-to-reach north (northern Albanian Alps), where foreign occupants &amp; others had ever exert any control.",
+              "Price: 1,299.00 EUR &quot;incl. VAT&quot; -\nshipping &lt;2 days&gt; <skipped>",
+      };
+      for (size_t i = 0; i < repeat; ++i)
+        sentences.insert(sentences.end(), samples.begin(), samples.end());
+      return sentences;
+    }
+
+    // Runs fn iterations times and prints the time per iteration
+    template <typename Fn>
+    double Measure(const std::string &name, size_t iterations, const Fn &fn) {
+      fn();  // warm up
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; ++i)
+        fn();
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      double per_iteration = elapsed.count() / iterations;
+      std::cout << name << ": " << per_iteration << " ms" << std::endl;
+      return per_iteration;
+    }
+
+} // namespace bench
+
+#endif //FAST_BLEUALIGN_BENCH_COMMON_H
@@ -0,0 +1,100 @@
+#include "bench_common.h"
+#include "../src/ngram.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+  // The sorted keys and counts of the n-grams of one order of a sentence
+  struct KeySet {
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> counts;
+  };
+
+  // Sets of size keys each, whose i-th key is common[i] with probability
+  // shared, so that sets made from the same common keys overlap
+  std::vector<KeySet> MakeSets(std::mt19937 &random, size_t count, size_t size, double shared,
+                               const std::vector<uint32_t> &common) {
+    std::bernoulli_distribution from_common(shared);
+    std::vector<KeySet> sets(count);
+    for (KeySet &set : sets) {
+      for (size_t i = 0; i < size; ++i)
+        set.keys.push_back(from_common(random) ? common[i] : uint32_t(random()));
+      std::sort(set.keys.begin(), set.keys.end());
+      set.keys.erase(std::unique(set.keys.begin(), set.keys.end()), set.keys.end());
+      for (size_t i = 0; i < set.keys.size(); ++i)
+        set.counts.push_back(random() % 8 == 0 ? 2 : 1);
+    }
+    return sets;
+  }
+
+  // Intersects every set of left with every set of right, like EvalSents
+  // does for one order
+  template <typename Intersect>
+  uint64_t IntersectAll(const std::vector<KeySet> &left, const std::vector<KeySet> &right,
+                        const Intersect &intersect) {
+    uint64_t correct = 0;
+    for (const KeySet &l : left)
+      for (const KeySet &r : right)
+        correct += intersect(l.keys.data(), l.keys.data() + l.keys.size(), l.counts.data(),
+                             r.keys.data(), r.keys.data() + r.keys.size(), r.counts.data());
+    return correct;
+  }
+
+}
+
+// Intersects the n-gram keys of sentences of typical lengths with the plain
+// merge and with intersect_counts, for unrelated sentences, translations of
+// each other, and a short sentence against a long merged one
+int main() {
+  std::mt19937 random(42);
+  struct Case {
+    std::string name;
+    size_t lsize;
+    size_t rsize;
+    double shared;
+  };
+  const std::vector<Case> cases = {
+          {"5 x 5 keys, unrelated", 5, 5, 0.0},
+          {"10 x 10 keys, unrelated", 10, 10, 0.0},
+          {"20 x 20 keys, unrelated", 20, 20, 0.0},
+          {"40 x 40 keys, unrelated", 40, 40, 0.0},
+          {"60 x 60 keys, unrelated", 60, 60, 0.0},
+          {"20 x 20 keys, some shared", 20, 20, 0.5},
+          {"40 x 40 keys, some shared", 40, 40, 0.5},
+          {"20 x 25 keys, most shared", 20, 25, 0.9},
+          {"4 x 300 keys, some shared", 4, 300, 0.7},
+  };
+
+  uint64_t total = 0;
+  for (const Case &c : cases) {
+    std::vector<uint32_t> common(std::max(c.lsize, c.rsize));
+    for (uint32_t &key : common)
+      key = random();
+    std::vector<KeySet> left = MakeSets(random, 300, c.lsize, c.shared, common);
+    std::vector<KeySet> right = MakeSets(random, 300, c.rsize, c.shared, common);
+
+    std::cout << c.name << std::endl;
+    uint64_t scalar_correct = 0, simd_correct = 0;
+    double scalar = bench::Measure("  scalar merge", 5, [&]() {
+      scalar_correct = IntersectAll(left, right, ngram::intersect_counts_scalar);
+    });
+    double simd = bench::Measure("  intersect_counts", 5, [&]() {
+      simd_correct = IntersectAll(left, right, ngram::intersect_counts);
+    });
+
+    if (scalar_correct != simd_correct) {
+      std::cerr << "intersect_counts counted " << simd_correct << " instead of " << scalar_correct << std::endl;
+      return 1;
+    }
+    std::cout << "  speedup " << scalar / simd << "x" << std::endl;
+    total += simd_correct;
+  }
+
+  std::cout << total << " matching n-grams" << std::endl;
+  return 0;
+}
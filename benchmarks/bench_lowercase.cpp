@@ -0,0 +1,80 @@
+#include "bench_common.h"
+#include "../src/scorer.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unicode/uchar.h>
+#include <unicode/utf8.h>
+
+
+namespace {
+
+  // Folds every code point through ICU, without the ASCII fast path
+  void FoldCodePoints(std::string &out, const std::string &text) {
+    out.clear();
+    int32_t length = int32_t(text.size());
+    for (int32_t i = 0; i < length;) {
+      UChar32 c;
+      U8_NEXT(text.data(), i, length, c);
+      if (c < 0)
+        c = 0xfffd;
+      c = u_foldCase(c, U_FOLD_CASE_DEFAULT);
+      uint8_t bytes[U8_MAX_LENGTH];
+      int32_t size = 0;
+      U8_APPEND_UNSAFE(bytes, size, c);
+      out.append(reinterpret_cast<const char *>(bytes), size);
+    }
+  }
+
+}
+
+// Lowercases samples of several languages with ICU per code point, and
+// normalizes them with and without lowercasing to see what the fast paths save
+int main() {
+  const std::vector<std::pair<std::string, std::string>> languages = {
+          {"English", "More than three million Albanians living outside Albania, the majority of them in Kosovo."},
+          {"German", "\xc3\x9c" "BER 70% DER ALBANER WAREN W\xc3\x84HREND DER T\xc3\x9c" "RKISCHEN HERRSCHAFT Muslime."},
+          {"French", "\xc3\x80 l'\xc3\x89" "COLE, les \xc3\xa9l\xc3\xa8ves \xc3\xa9tudient l'histoire de l'Albanie."},
+          {"Russian", "\xd0\x91\xd0\x9e\xd0\x9b\xd0\x95\xd0\x95 \xd0\xa2\xd0\xa0\xd0\x81\xd0\xa5 \xd0\xbc\xd0\xb8\xd0\xbb\xd0\xbb\xd0\xb8"
+                      "\xd0\xbe\xd0\xbd\xd0\xbe\xd0\xb2 \xd0\x90\xd0\xbb\xd0\xb1\xd0\xb0\xd0\xbd\xd1\x86\xd0\xb5\xd0\xb2."},
+          {"Greek", "\xce\x9f\xce\x99 \xce\x91\xce\xbb\xce\xb2\xce\xb1\xce\xbd\xce\xbf\xce\xaf \xce\xa4\xce\x97\xce\xa3 "
+                    "\xce\x9a\xce\x9f\xce\xa3\xce\x9f\xce\x92\xce\x9f\xce\xa5."},
+          {"Chinese", "\xe8\xb6\x85\xe8\xbf\x87\xe4\xb8\x89\xe7\x99\xbe\xe4\xb8\x87\xe9\x98\xbf\xe5\xb0\x94\xe5\xb7\xb4"
+                      "\xe5\xb0\xbc\xe4\xba\x9a\xe4\xba\xba\xe4\xbd\x8f\xe5\x9c\xa8 Kosovo\xe3\x80\x82"},
+  };
+
+  size_t repeat = 20000;
+  size_t bytes = 0;
+  scorer::Normalizer western("western");
+  scorer::Normalizer other("other");
+  std::string folded;
+
+  for (auto &language : languages) {
+    std::cout << language.first << std::endl;
+    std::vector<std::string> sentences(repeat, language.second);
+
+    double icu = bench::Measure("  ICU per code point", 3, [&]() {
+      for (const std::string &sentence : sentences) {
+        FoldCodePoints(folded, sentence);
+        bytes += folded.size();
+      }
+    });
+
+    double lowercase = bench::Measure("  normalizer", 3, [&]() {
+      for (const std::string &sentence : sentences)
+        bytes += western(sentence).size();
+    });
+
+    double plain = bench::Measure("  normalizer without lowercasing", 3, [&]() {
+      for (const std::string &sentence : sentences)
+        bytes += other(sentence).size();
+    });
+
+    std::cout << "  lowercasing takes " << lowercase - plain << " ms of the normalizer, "
+              << icu << " ms through ICU" << std::endl;
+  }
+
+  std::cout << bytes << " bytes" << std::endl;
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "bench_common.h"
+#include "../src/ngram.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace {
+
+  typedef std::unordered_map<size_t, size_t> ngram_map;
+
+  // Counts the n-grams of tokens like NGramCounter::process did, with a hash
+  // map per order that is sorted afterwards
+  size_t MapCount(const uint64_t *begin, const uint64_t *end, unsigned short ngram_size) {
+    std::vector<ngram_map> maps(ngram_size);
+    for (const uint64_t *last = begin; last != end; ++last) {
+      size_t hash = *last;
+      maps[0][hash] += 1;
+      for (unsigned short order = 2; order <= ngram_size && order <= last - begin + 1; ++order) {
+        hash = ngram::get_token_hash(*(last - order + 1), hash);
+        maps[order - 1][hash] += 1;
+      }
+    }
+
+    size_t size = 0;
+    for (ngram_map &map : maps) {
+      ngram::ngram_vector counts;
+      counts.reserve(map.size());
+      std::move(map.begin(), map.end(), std::back_inserter(counts));
+      std::sort(counts.begin(), counts.end());
+      size += counts.size();
+    }
+    return size;
+  }
+
+}
+
+// Counts the n-grams of random sentences of typical lengths with hash maps
+// and with NGramCounter
+int main() {
+  std::mt19937_64 random(42);
+  // A Zipf-like vocabulary, so that short n-grams repeat within a sentence
+  std::vector<uint64_t> vocabulary(2000);
+  for (size_t i = 0; i < vocabulary.size(); ++i)
+    vocabulary[i] = ngram::get_token_hash(std::to_string(i));
+  std::discrete_distribution<size_t> word(vocabulary.size(), 0.0, double(vocabulary.size()),
+                                          [](double rank) { return 1.0 / (rank + 1); });
+
+  size_t total = 0;
+  for (unsigned short ngram_size : {2, 4}) {
+    for (size_t length : {5, 10, 20, 40, 60}) {
+      std::vector<std::vector<uint64_t>> sentences(200000 / length);
+      for (std::vector<uint64_t> &sentence : sentences)
+        for (size_t i = 0; i < length; ++i)
+          sentence.push_back(vocabulary[word(random)]);
+
+      std::cout << "n = " << ngram_size << ", " << length << " tokens" << std::endl;
+      double map = bench::Measure("  hash maps", 3, [&]() {
+        for (const std::vector<uint64_t> &sentence : sentences)
+          total += MapCount(sentence.data(), sentence.data() + sentence.size(), ngram_size);
+      });
+
+      double sorted = bench::Measure("  NGramCounter", 3, [&]() {
+        for (const std::vector<uint64_t> &sentence : sentences) {
+          ngram::NGramCounter counter(ngram_size);
+          counter.process(sentence);
+          total += counter.count_tokens();
+        }
+      });
+
+      std::cout << "  speedup " << map / sorted << "x" << std::endl;
+    }
+  }
+
+  std::cout << total << " n-grams" << std::endl;
+  return 0;
+}
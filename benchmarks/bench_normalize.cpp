@@ -0,0 +1,41 @@
+#include "bench_common.h"
+#include "../src/scorer.h"
+
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+
+namespace {
+
+  // normalize as it was written with the regex passes
+  std::string RegexNormalize(const std::string &text) {
+    std::string normalized_text = scorer::ApplyNormalizeRules(text, scorer::normalize1_rules);
+    normalized_text = scorer::ApplyNormalizeRules(normalized_text, scorer::normalize2_rules);
+    boost::algorithm::to_lower(normalized_text);
+    normalized_text.insert(0, " ");
+    normalized_text.push_back(' ');
+    return normalized_text;
+  }
+
+}
+
+// Normalizes the sentences of a file, or of built-in samples, with the regex passes and the single scan
+int main(int argc, char *argv[]) {
+  std::vector<std::string> sentences = bench::LoadSentences(argc, argv);
+  size_t bytes = 0;
+
+  double regex = bench::Measure("regex", 3, [&]() {
+    for (const std::string &sentence : sentences)
+      bytes += RegexNormalize(sentence).size();
+  });
+
+  scorer::Normalizer normalizer("western");
+  double single = bench::Measure("single pass", 3, [&]() {
+    for (const std::string &sentence : sentences)
+      bytes += normalizer(sentence).size();
+  });
+
+  std::cout << sentences.size() << " sentences, " << bytes << " bytes, speedup " << regex / single << "x" << std::endl;
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include "bench_common.h"
+#include "../src/scorer.h"
+
+#include <string>
+#include <vector>
+#include <boost/regex.hpp>
+
+
+namespace {
+
+  // Tokenize as it was written on top of tokenize_regex
+  void RegexTokenize(std::vector<std::string> &token_vec, const std::string &text) {
+    token_vec.clear();
+
+    boost::sregex_iterator it(text.begin(), text.end(), scorer::tokenize_regex);
+    boost::sregex_iterator end;
+    size_t last_pos = 0;
+
+    for (; it != end; ++it) {
+      std::string token = text.substr(last_pos, it->position() - last_pos);
+
+      if (token.length() > 0) {
+        token_vec.push_back(token);
+      }
+      if (it->str() != " ") {
+        token_vec.push_back(it->str());
+      }
+
+      last_pos = it->position() + it->str().length();
+    }
+
+    if (last_pos < text.length()) {
+      token_vec.push_back(text.substr(last_pos, text.length() - last_pos));
+    }
+  }
+
+}
+
+// Tokenizes the sentences of a file, or of built-in samples, with the regex and the byte class scanner
+int main(int argc, char *argv[]) {
+  std::vector<std::string> sentences = bench::LoadSentences(argc, argv);
+  std::vector<std::string> token_vec;
+  size_t tokens = 0;
+
+  double regex = bench::Measure("regex", 5, [&]() {
+    for (const std::string &sentence : sentences) {
+      RegexTokenize(token_vec, sentence);
+      tokens += token_vec.size();
+    }
+  });
+
+  double table = bench::Measure("table", 5, [&]() {
+    for (const std::string &sentence : sentences) {
+      scorer::Tokenize(token_vec, sentence);
+      tokens += token_vec.size();
+    }
+  });
+
+  std::vector<uint64_t> token_hashes;
+  bench::Measure("table, hashes", 5, [&]() {
+    for (const std::string &sentence : sentences) {
+      scorer::Tokenize(token_hashes, sentence);
+      tokens += token_hashes.size();
+    }
+  });
+
+  std::cout << sentences.size() << " sentences, " << tokens << " tokens, speedup " << regex / table << "x" << std::endl;
+  return 0;
+}
@@ -1,8 +1,14 @@
 
 #include "src/align.h"
 #include "src/utils/common.h"
+#include "src/utils/line_reader.h"
+#include "src/utils/output_writer.h"
+#include "src/utils/compression.h"
+#include "src/utils/tsv_format.h"
+#include "src/utils/token_format.h"
+#include "src/utils/checkpoint.h"
+#include "util/murmur_hash.hh"
 
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -10,216 +16,409 @@
 #include <algorithm>
 #include <numeric>
 #include <unordered_map>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <boost/program_options.hpp>
+#include <boost/make_unique.hpp>
 
 namespace po = boost::program_options;
 
-std::vector<std::string> GetMandatoryHeaderFields(const std::vector<std::string> &split_metadata_headers) {
-  std::vector<std::string> header_mandatory_values = {"src_url", "trg_url", "src_text", "trg_text", "src_translated"};
+void WriteOutputHeader(utils::OutputWriter &out, bool print_sent_hash,
+                       const std::vector<std::string> &split_metadata_headers) {
+  // Print output header
+  std::string &header_line = out.buffer();
+  header_line += "src_url\ttrg_url\tsrc_text\ttrg_text\tbleualign_score";
+
+  if (print_sent_hash)
+    header_line += "\tsrc_deferred_hash\ttrg_deferred_hash";
 
-  if (split_metadata_headers.size() != 0) {
-    header_mandatory_values.push_back("src_metadata");
-    header_mandatory_values.push_back("trg_metadata");
+  for (const std::string &metadata_header_field : split_metadata_headers) {
+    header_line += "\tsrc_" + metadata_header_field + "\ttrg_" + metadata_header_field;
   }
 
-  return header_mandatory_values;
+  header_line += "\n";
 }
 
-std::unordered_map<std::string, int> ProcessHeader(std::istream &in, bool print_sent_hash,
-                                                   const std::vector<std::string> &split_metadata_headers) {
-  std::string line;
-  std::vector<std::string> split_line;
+// Selects the document pairs of shard index out of count by a hash of their
+// urls, so a shard gets the same pairs whatever the input order or threads
+struct Shard {
+  size_t index = 0;
+  size_t count = 1;
+
+  bool all() const { return count == 1; }
+
+  bool contains(boost::string_ref url1, boost::string_ref url2) const {
+    uint64_t key = util::MurmurHash64A(url2.data(), url2.size(), util::MurmurHash64A(url1.data(), url1.size()));
+    return key % count == index;
+  }
+};
+
+Shard ParseShard(const std::string &spec) {
+  Shard shard;
+  std::vector<std::string> parts;
+  utils::SplitString(parts, spec, '/');
+
+  try {
+    if (parts.size() != 2)
+      throw std::invalid_argument(spec);
+    size_t pos_index, pos_count;
+    shard.index = std::stoul(parts[0], &pos_index);
+    shard.count = std::stoul(parts[1], &pos_count);
+    if (pos_index != parts[0].size() || pos_count != parts[1].size())
+      throw std::invalid_argument(spec);
+  } catch (const std::logic_error &) {
+    throw std::runtime_error("Invalid --shard " + spec + ", expected K/N");
+  }
 
-  // Read header
-  getline(in, line);
-  utils::SplitString(split_line, line, '\t');
+  if (shard.count == 0 || shard.index >= shard.count)
+    throw std::runtime_error("Invalid --shard " + spec + ", K must be between 0 and N - 1");
 
-  std::unordered_map<std::string, int> header;
-  std::vector<std::string> header_mandatory_values = GetMandatoryHeaderFields(split_metadata_headers);
+  return shard;
+}
 
-  for (size_t i = 0; i < split_line.size(); ++i) {
-    // Get all fields
-    header[split_line[i]] = i;
+struct ProcessOptions {
+  float bleu_threshold = 0.0f;
+  bool print_sent_hash = false;
+  std::vector<std::string> split_metadata_headers;
+  size_t threads = 1;
+  Shard shard;
+  bool output_header = true;
+  // Normalizer profile of TSV input, pre-tokenized input must have been normalized with it
+  std::string language_type = "western";
+  unsigned short ngram_order = align::default_ngram_size;
+  size_t max_alternatives = align::default_max_alternatives;
+  // Saves checkpoints while aligning, if set
+  utils::Checkpointer *checkpointer = nullptr;
+  // Continue the input file after the records this checkpoint covers, if set
+  const utils::Checkpoint *resume = nullptr;
+};
+
+// Aligns doc_pair and appends its matches to out. decode_output() fills in
+// the columns that are only printed, so that document pairs without matches
+// never decode them.
+template <typename DecodeOutput>
+void AlignDocument(utils::DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line, size_t n,
+                   const ProcessOptions &options, const DecodeOutput &decode_output, utils::matches_vec &matches,
+                   std::string &out) {
+  align::AlignDocument(matches, doc_pair, options.bleu_threshold, options.language_type, options.ngram_order,
+                       options.max_alternatives);
+  if (matches.empty())
+    return;
+
+  decode_output(doc_pair, split_line, n);
+  align::WriteAlignedText(out, matches, doc_pair.text1, doc_pair.text2, doc_pair.url1, doc_pair.url2,
+                          doc_pair.text1metadata, doc_pair.text2metadata, options.print_sent_hash);
+}
 
-    // Check out if it is a mandatory field
-    auto find_result = std::find(header_mandatory_values.begin(), header_mandatory_values.end(), split_line[i]);
+// A single input line travelling through the threaded pipeline. Workers fill in either the aligned output
+// or the error, and the writer emits them in input order. An error reading the input ends the queue as a
+// job of its own. Lines are copied into storage only when the reader reuses its buffer.
+struct PipelineJob {
+  size_t n;
+  size_t columns;
+  uint64_t end_offset;
+  boost::string_ref line;
+  std::string storage;
+  std::string output;
+  std::exception_ptr error;
+  bool done = false;
+};
+
+template <typename Parse, typename DecodeOutput, typename Select>
+void ProcessThreaded(utils::LineReader &in, utils::OutputWriter &writer, const ProcessOptions &options,
+                     const Parse &parse, const DecodeOutput &decode_output, const Select &select) {
+  const size_t max_in_flight = options.threads * 4;
+
+  std::mutex mutex;
+  std::condition_variable work_available;  // reader -> workers
+  std::condition_variable job_finished;    // workers -> writer
+  std::condition_variable slot_available;  // writer -> reader
+
+  std::deque<std::shared_ptr<PipelineJob>> in_flight; // in input order, consumed by the writer
+  std::deque<std::shared_ptr<PipelineJob>> pending;   // not yet picked up by a worker
+  bool reader_done = false;
+  bool stop = false;
+
+  auto worker = [&]() {
+    utils::DocumentPair doc_pair;
+    std::vector<boost::string_ref> split_line;
+    utils::matches_vec matches;
+
+    while (true) {
+      std::shared_ptr<PipelineJob> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_available.wait(lock, [&] { return stop || reader_done || !pending.empty(); });
+        if (stop || pending.empty())
+          return;
+        job = pending.front();
+        pending.pop_front();
+      }
 
-    if (find_result != std::end(header_mandatory_values)) {
-      header_mandatory_values.erase(find_result);
+      try {
+        parse(doc_pair, split_line, job->line, job->n, job->columns);
+        AlignDocument(doc_pair, split_line, job->n, options, decode_output, matches, job->output);
+      } catch (...) {
+        job->error = std::current_exception();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        job->line.clear();
+        std::string().swap(job->storage);
+        job->done = true;
+      }
+      job_finished.notify_all();
     }
-  }
+  };
 
-  if (header_mandatory_values.size() != 0) {
-    // Not all mandatory fields were provided
-    std::stringstream error;
+  auto reader = [&]() {
+    try {
+      size_t n = options.resume ? options.resume->line : 0;
+      size_t columns = options.resume ? options.resume->columns : 0;
+      boost::string_ref line;
+
+      while (in.read_line(line)) {
+        ++n;
 
-    error << "Mandatory fields not found in header:";
+        if (columns == 0) {
+          // Initialize the expected number of fields for all the lines
+          columns = utils::CountFields(line);
+        }
 
-    for (std::string h : header_mandatory_values) {
-      error << ' ' << h;
+        if (!select(line, n))
+          continue;
+
+        std::shared_ptr<PipelineJob> job = std::make_shared<PipelineJob>();
+        job->n = n;
+        job->columns = columns;
+        job->end_offset = in.offset();
+        if (in.lines_persist()) {
+          job->line = line;
+        } else {
+          job->storage.assign(line.data(), line.size());
+          job->line = job->storage;
+        }
+
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          slot_available.wait(lock, [&] { return stop || in_flight.size() < max_in_flight; });
+          if (stop)
+            break;
+          in_flight.push_back(job);
+          pending.push_back(job);
+        }
+        work_available.notify_one();
+      }
+    } catch (...) {
+      // A damaged input fails after the lines before it were written, like
+      // the serial loop, so the error goes through the queue in input order
+      std::shared_ptr<PipelineJob> job = std::make_shared<PipelineJob>();
+      job->error = std::current_exception();
+      job->done = true;
+      std::lock_guard<std::mutex> lock(mutex);
+      in_flight.push_back(job);
     }
 
-    throw std::runtime_error(error.str());
-  }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      reader_done = true;
+    }
+    work_available.notify_all();
+    job_finished.notify_all();
+  };
+
+  std::vector<std::thread> pool;
+  pool.emplace_back(reader);
+  for (size_t i = 0; i < options.threads; ++i)
+    pool.emplace_back(worker);
+
+  // The calling thread is the writer, so that errors are raised from here in input order
+  std::exception_ptr error;
+  while (true) {
+    std::shared_ptr<PipelineJob> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      job_finished.wait(lock, [&] { return (!in_flight.empty() && in_flight.front()->done) ||
+                                           (reader_done && in_flight.empty()); });
+      if (in_flight.empty())
+        break;
+      job = in_flight.front();
+      in_flight.pop_front();
+    }
+    slot_available.notify_one();
 
-  // Print output header
-  std::cout << "src_url\ttrg_url\tsrc_text\ttrg_text\tbleualign_score";
+    if (job->error) {
+      error = job->error;
+      break;
+    }
 
-  if (print_sent_hash)
-    std::cout << "\tsrc_deferred_hash\ttrg_deferred_hash";
+    writer.buffer() += job->output;
+    writer.document_done();
+    if (options.checkpointer)
+      options.checkpointer->document_done(job->n, job->end_offset, job->columns);
+  }
 
-  for (const std::string &metadata_header_field : split_metadata_headers) {
-    std::cout << "\tsrc_" << metadata_header_field << "\ttrg_" << metadata_header_field;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
   }
+  work_available.notify_all();
+  slot_available.notify_all();
 
-  std::cout << "\n";
+  for (std::thread &t : pool)
+    t.join();
 
-  return header;
+  if (error)
+    std::rethrow_exception(error);
 }
 
-void Process(std::istream &in, float bleu_threshold, bool print_sent_hash, std::string metadata_headers) {
-  utils::DocumentPair doc_pair;
-  std::string line;
-  std::vector<std::string> split_line;
-  std::vector<std::string> split_metadata_headers;
-
-  utils::SplitString(split_metadata_headers, metadata_headers, ',');
-
-  std::unordered_map<std::string, int> header_idxs = ProcessHeader(in, print_sent_hash, split_metadata_headers);
-  std::vector<std::string> header_mandatory_fields = GetMandatoryHeaderFields(split_metadata_headers);
+// Aligns the document pairs parse() makes of each record of the input that
+// select() keeps. parse is given scratch space, the record, its number and the
+// number of fields of the first record, which only the TSV format uses. It
+// may leave the columns that are only printed to decode_output().
+template <typename Parse, typename DecodeOutput, typename Select>
+void ProcessDocuments(utils::LineReader &in, utils::OutputWriter &writer, const ProcessOptions &options,
+                      const Parse &parse, const DecodeOutput &decode_output, const Select &select) {
+  // A resumed file already has its header in the output
+  if (options.resume)
+    in.skip_to(options.resume->input_offset);
+  else if (options.output_header)
+    WriteOutputHeader(writer, options.print_sent_hash, options.split_metadata_headers);
+
+  if (options.threads > 1) {
+    ProcessThreaded(in, writer, options, parse, decode_output, select);
+    return;
+  }
 
-  size_t n = 0;
-  size_t columns = 0;
-  bool metadata = split_metadata_headers.size() != 0 ? true : false;
+  utils::DocumentPair doc_pair;
+  boost::string_ref line;
+  std::vector<boost::string_ref> split_line;
+  utils::matches_vec matches;
+  size_t n = options.resume ? options.resume->line : 0;
+  size_t columns = options.resume ? options.resume->columns : 0;
 
-  while(getline(in, line)) {
+  while(in.read_line(line)) {
     ++n;
 
-    utils::SplitString(split_line, line, '\t');
-
     if (columns == 0) {
       // Initialize the expected number of fields for all the lines
-      columns = split_line.size();
+      columns = utils::CountFields(line);
     }
 
-    // Expect at least 5 (maybe 6 or more if metadata is present) columns
-    if (split_line.size() < header_mandatory_fields.size()) {
-      std::stringstream error;
-      error << "Not enough fields on line " << n << " mandatory header fields are:";
+    if (!select(line, n))
+      continue;
 
-      for (const std::string &field : header_mandatory_fields) {
-        error << " " << field;
-      }
-
-      throw std::runtime_error(error.str());
-    }
-    // Check that the number of fields is the expected, since all the lines should contain the same number of fields
-    if (columns != split_line.size()) {
-      std::stringstream error;
-      error << "Different number of fields obtained on line " << n;
-      throw std::runtime_error(error.str());
-    }
-
-    doc_pair.url1 = split_line[header_idxs["src_url"]];
-    doc_pair.url2 = split_line[header_idxs["trg_url"]];
-    utils::DecodeAndSplit(doc_pair.text1, split_line[header_idxs["src_text"]], '\n', true);
-    utils::DecodeAndSplit(doc_pair.text2, split_line[header_idxs["trg_text"]], '\n', true);
-
-    // Process metadata, if provided
-    if (metadata) {
-      std::vector<std::string> metadata1, metadata2;
-      utils::DecodeAndSplit(metadata1, split_line[header_idxs["src_metadata"]], '\n', true);
-      utils::DecodeAndSplit(metadata2, split_line[header_idxs["trg_metadata"]], '\n', true);
-
-      if (doc_pair.text1.size() != metadata1.size()) {
-        std::stringstream error;
-        error << "On line " << n << " column " << header_idxs["src_text"] + 1 << " and "
-              << header_idxs["src_metadata"] + 1 << " don't have an equal number of lines "
-              << "(" << doc_pair.text1.size() << " vs " << metadata1.size() << ")";
-        throw std::runtime_error(error.str());
-      }
-      if (doc_pair.text2.size() != metadata2.size()) {
-        std::stringstream error;
-        error << "On line " << n << " column " << header_idxs["trg_text"] + 1 << " and "
-              << header_idxs["trg_metadata"] + 1 << " don't have an equal number of lines "
-              << "(" << doc_pair.text2.size() << " vs " << metadata2.size() << ")";
-        throw std::runtime_error(error.str());
-      }
+    parse(doc_pair, split_line, line, n, columns);
 
-      if (doc_pair.text1metadata.size() < doc_pair.text1.size()) {
-        doc_pair.text1metadata.resize(doc_pair.text1.size());
-      }
-      if (doc_pair.text2metadata.size() < doc_pair.text2.size()) {
-        doc_pair.text2metadata.resize(doc_pair.text2.size());
-      }
-
-      for (size_t i = 0; i < metadata1.size(); ++i) {
-        utils::SplitString(doc_pair.text1metadata[i], metadata1[i], '\t');
+    AlignDocument(doc_pair, split_line, n, options, decode_output, matches, writer.buffer());
+    writer.document_done();
+    if (options.checkpointer)
+      options.checkpointer->document_done(n, in.offset(), columns);
+  }
+}
 
-        if (doc_pair.text1metadata[i].size() != split_metadata_headers.size()) {
-          std::stringstream error;
-          error << "On line " << n << " column " << header_idxs["src_metadata"] + 1 << " "
-                << "has " << doc_pair.text1metadata[i].size() << " fields, but "
-                << split_metadata_headers.size() << " were provided";
-          throw std::runtime_error(error.str());
-        }
-      }
-      for (size_t i = 0; i < metadata2.size(); ++i) {
-        utils::SplitString(doc_pair.text2metadata[i], metadata2[i], '\t');
-
-        if (doc_pair.text2metadata[i].size() != split_metadata_headers.size()) {
-          std::stringstream error;
-          error << "On line " << n << " column " << header_idxs["trg_metadata"] + 1 << " "
-                << "has " << doc_pair.text2metadata[i].size() << " fields, but "
-                << split_metadata_headers.size() << " were provided";
-          throw std::runtime_error(error.str());
-        }
-      }
-    }
+void Process(utils::LineReader &in, utils::OutputWriter &writer, const ProcessOptions &options) {
+  const std::vector<std::string> &split_metadata_headers = options.split_metadata_headers;
+  std::unordered_map<std::string, int> header_idxs = utils::ReadTsvHeader(in, split_metadata_headers);
+  std::vector<std::string> header_mandatory_fields = utils::GetMandatoryHeaderFields(split_metadata_headers);
+  int url1_column = header_idxs.at("src_url");
+  int url2_column = header_idxs.at("trg_url");
+
+  ProcessDocuments(in, writer, options,
+                   [&](utils::DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line,
+                       boost::string_ref line, size_t n, size_t columns) {
+                     utils::ReadScoringColumns(doc_pair, split_line, line, n, columns, header_idxs,
+                                               header_mandatory_fields);
+                   },
+                   [&](utils::DocumentPair &doc_pair, const std::vector<boost::string_ref> &split_line, size_t n) {
+                     utils::ReadOutputColumns(doc_pair, split_line, n, header_idxs, split_metadata_headers);
+                   },
+                   [&](boost::string_ref line, size_t) {
+                     return options.shard.all() ||
+                            options.shard.contains(utils::GetField(line, url1_column),
+                                                   utils::GetField(line, url2_column));
+                   });
+}
 
-    // Processed version of text 1 (i.e. translated to match language text 2)
-    utils::DecodeAndSplit(doc_pair.text1translated, split_line[header_idxs["src_translated"]], '\n', true);
-    if (doc_pair.text1.size() != doc_pair.text1translated.size()) {
-      std::stringstream error;
-      error << "On line " << n << " column " << header_idxs["src_text"] + 1 << " and "
-            << header_idxs["src_translated"] + 1 << " don't have an equal number of lines "
-            << "(" << doc_pair.text1.size() << " vs " << doc_pair.text1translated.size() << ")";
-      throw std::runtime_error(error.str());
-    }
-    
-    // Optionally sixth column with processed version of text 2 (i.e. to better
-    // match with the processed version of text 1)
-    if (header_idxs.find("trg_translated") == header_idxs.end()) {
-      doc_pair.text2translated = doc_pair.text2;
-    } else {
-      utils::DecodeAndSplit(doc_pair.text2translated, split_line[header_idxs["trg_translated"]], '\n', true);
-
-      if (doc_pair.text2.size() != doc_pair.text2translated.size()) {
-        std::stringstream error; 
-        error << "On line " << n << " column " << header_idxs["trg_text"] + 1 << " and "
-              << header_idxs["trg_translated"] + 1 << " don't have an equal number of lines "
-              << "(" << doc_pair.text2.size() << " vs " << doc_pair.text2translated.size() << ")";
-        throw std::runtime_error(error.str());
-      }
-    }
+void ProcessTokenized(utils::LineReader &in, utils::OutputWriter &writer, const ProcessOptions &options) {
+  utils::TokenFileHeader header = utils::ReadTokenHeader(in);
 
-    align::AlignDocument(doc_pair, bleu_threshold, print_sent_hash);
-    std::cout << std::flush;
+  bool metadata = !options.split_metadata_headers.empty();
+  if (metadata && header.metadata_fields != options.split_metadata_headers) {
+    std::stringstream error;
+    error << "Metadata header fields of the pre-tokenized input are";
+    for (const std::string &field : header.metadata_fields)
+      error << " " << field;
+    error << " but not the ones requested";
+    throw std::runtime_error(error.str());
   }
+
+  if (header.normalizer != options.language_type)
+    throw std::runtime_error("Pre-tokenized input was normalized for language type " + header.normalizer +
+                             ", align it with --language-type " + header.normalizer);
+
+  ProcessDocuments(in, writer, options,
+                   [&](utils::DocumentPair &doc_pair, std::vector<boost::string_ref> &,
+                       boost::string_ref record, size_t n, size_t) {
+                     utils::ReadTokenRecord(doc_pair, record, n, header, metadata);
+                   },
+                   [](utils::DocumentPair &, const std::vector<boost::string_ref> &, size_t) {},
+                   [&](boost::string_ref record, size_t n) {
+                     if (options.shard.all())
+                       return true;
+                     boost::string_ref url1, url2;
+                     utils::ReadTokenRecordUrls(url1, url2, record, n);
+                     return options.shard.contains(url1, url2);
+                   });
 }
 
 int main(int argc, char *argv[]) {
-  float bleu_threshold = 0.0f;
-  bool print_sent_hash = false;
+  ProcessOptions options;
   std::string metadata_header_fields;
+  std::string shard;
+  bool no_output_header = false;
+  double flush_interval = 1.0;
+  std::string output_compression;
+  std::string input_format = "tsv";
+  std::string output_filename;
+  std::string checkpoint_filename;
+  double checkpoint_interval = 300.0;
+  bool resume = false;
+  bool print_stats = false;
   std::vector<std::string> filenames;
 
   po::options_description desc("Allowed options");
   desc.add_options()
           ("help", "produce help message")
-          ("bleu-threshold", po::value(&bleu_threshold), "BLEU threshold for matched sentences")
-          ("print-sent-hash", po::bool_switch(&print_sent_hash)->default_value(false), "print Murmurhash hashes of the output sentences")
+          ("bleu-threshold", po::value(&options.bleu_threshold), "BLEU threshold for matched sentences")
+          ("print-sent-hash", po::bool_switch(&options.print_sent_hash)->default_value(false), "print Murmurhash hashes of the output sentences")
           ("metadata-header-fields", po::value(&metadata_header_fields), "language agnostic header fields, comma separated")
+          ("flush-interval", po::value(&flush_interval)->default_value(1.0), "seconds between output flushes, 0 flushes after every document pair")
+          ("input-format", po::value(&input_format)->default_value("tsv"), "tsv, or tokens for files written by bleualign_cpp_pretokenize")
+          ("language-type", po::value(&options.language_type)->default_value("western"), "western, or cjk to score every Chinese, Japanese or Thai character as a word")
+          ("ngram-order", po::value(&options.ngram_order)->default_value(align::default_ngram_size), "score sentences with BLEU over n-grams of order 1 to this, at most 4")
+          ("max-alternatives", po::value(&options.max_alternatives)->default_value(align::default_max_alternatives), "number of best scoring sentences of text2 kept for every sentence of text1")
+          ("output-compression", po::value(&output_compression), "compress the output with gzip or zstd, using --threads threads")
+          ("shard", po::value(&shard), "only align the document pairs of shard K out of N (0 <= K < N), chosen by a hash of their urls")
+          ("no-output-header", po::bool_switch(&no_output_header)->default_value(false), "do not print the output header, e.g. for shards other than the first")
+          ("threads", po::value(&options.threads)->default_value(1), "number of worker threads aligning document pairs and scoring large documents (0 uses all cores), output order is preserved")
+          ("output", po::value(&output_filename), "write the output to this file instead of stdout")
+          ("checkpoint", po::value(&checkpoint_filename), "periodically save how far the run got to this file, needs --output")
+          ("checkpoint-interval", po::value(&checkpoint_interval)->default_value(300.0), "seconds between checkpoints")
+          ("resume", po::bool_switch(&resume)->default_value(false), "continue the run saved in --checkpoint, or start it if there is none")
+          ("print-stats", po::bool_switch(&print_stats)->default_value(false), "print to stderr how many sentence pairs were pruned by their lengths")
           ("input-file", po::value(&filenames));
 
   po::positional_options_description positional;
@@ -236,18 +435,139 @@ int main(int argc, char *argv[]) {
 	    "Tab-separated fields of the output are url1, url2, sent1, sent2, score [ , murmurhash_text1, murmurhash_text2 ]\n"
       "[ , metadata1_text1, metadata1_text2 ...] \n\n" <<
       "Usage: " << argv[0] << " [--help] [--bleu-threshold <threshold>] [--print-sent-hash] [--metadata-header-fields <field1>,...]\n"
-      "[<input-file>...]\n\n" <<
+      "[--threads <n>] [--flush-interval <seconds>] [--output-compression gzip|zstd] [--input-format tsv|tokens]\n"
+      "[--language-type western|cjk] [--ngram-order <n>] [--max-alternatives <n>]\n"
+      "[--shard K/N] [--no-output-header] [--output <file> [--checkpoint <file> [--resume]]] [--print-stats]\n"
+      "[<input-file>...]\n\n"
+      "Input compressed with gzip, xz or zstd is decompressed automatically\n\n" <<
 	    desc << std::endl;
     return 1;
   }
 
+  if (options.threads == 0)
+    options.threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  align::SetScoringThreads(options.threads);
+
+  if (input_format != "tsv" && input_format != "tokens") {
+    std::cerr << "Unknown input format " << input_format << ", expected tsv or tokens" << std::endl;
+    return 1;
+  }
+
+  if (options.language_type != "western" && options.language_type != "cjk") {
+    std::cerr << "Unknown language type " << options.language_type << ", expected western or cjk" << std::endl;
+    return 1;
+  }
+
+  if (options.ngram_order < 1 || options.ngram_order > align::max_ngram_order) {
+    std::cerr << "--ngram-order must be between 1 and " << align::max_ngram_order << std::endl;
+    return 1;
+  }
+
+  if (options.max_alternatives < 1) {
+    std::cerr << "--max-alternatives must be at least 1" << std::endl;
+    return 1;
+  }
+
+  utils::SplitString(options.split_metadata_headers, metadata_header_fields, ',');
+  options.output_header = !no_output_header;
+  if (!shard.empty())
+    options.shard = ParseShard(shard);
+
   if (filenames.empty())
-    Process(std::cin, bleu_threshold, print_sent_hash, metadata_header_fields);
-  else
-    for (std::string const &filename : filenames) {
-      std::ifstream fin(filename);
-      Process(fin, bleu_threshold, print_sent_hash, metadata_header_fields);
+    filenames.push_back("-");
+
+  if (!checkpoint_filename.empty() && output_filename.empty()) {
+    std::cerr << "--checkpoint needs --output, the output is cut back to the checkpoint on --resume" << std::endl;
+    return 1;
+  }
+
+  if (resume && checkpoint_filename.empty()) {
+    std::cerr << "--resume needs --checkpoint" << std::endl;
+    return 1;
+  }
+
+  utils::Checkpoint checkpoint;
+  bool resuming = resume && utils::ReadCheckpoint(checkpoint_filename, checkpoint);
+  if (resuming) {
+    bool complete = checkpoint.file == filenames.size();
+    size_t file = complete ? checkpoint.file - 1 : checkpoint.file;
+    if (checkpoint.file > filenames.size() || filenames[file] != checkpoint.filename) {
+      std::cerr << "Checkpoint " << checkpoint_filename << " was saved with other input files, resume with the same"
+        " input files in the same order" << std::endl;
+      return 1;
+    }
+    if (complete) {
+      std::cerr << "The run in checkpoint " << checkpoint_filename << " is already complete" << std::endl;
+      return 0;
+    }
+  } else if (!checkpoint_filename.empty()) {
+    // A stale checkpoint must not outlive the output it describes
+    std::remove(checkpoint_filename.c_str());
+  }
+
+  int output_fd = STDOUT_FILENO;
+  if (!output_filename.empty()) {
+    output_fd = open(output_filename.c_str(), O_WRONLY | O_CREAT | (resuming ? 0 : O_TRUNC), 0666);
+    if (output_fd == -1) {
+      std::cerr << "Could not open output " << output_filename << ": " << std::strerror(errno) << std::endl;
+      return 1;
+    }
+
+    // Drop the output of the document pairs after the checkpoint, they are aligned again
+    if (resuming) {
+      struct stat st;
+      if (fstat(output_fd, &st) == -1 || uint64_t(st.st_size) < checkpoint.output_offset) {
+        std::cerr << "Output " << output_filename << " is shorter than checkpoint " << checkpoint_filename <<
+          " expects" << std::endl;
+        return 1;
+      }
+      if (ftruncate(output_fd, off_t(checkpoint.output_offset)) == -1 || lseek(output_fd, 0, SEEK_END) == -1) {
+        std::cerr << "Could not truncate output " << output_filename << ": " << std::strerror(errno) << std::endl;
+        return 1;
+      }
     }
+  }
+
+  utils::OutputWriter writer(utils::MakeCompressor(utils::ParseCompression(output_compression),
+                                                   boost::make_unique<utils::FdSink>(output_fd), options.threads),
+                             flush_interval);
+
+  std::unique_ptr<utils::Checkpointer> checkpointer;
+  if (!checkpoint_filename.empty()) {
+    checkpointer = boost::make_unique<utils::Checkpointer>(checkpoint_filename, checkpoint_interval, writer,
+                                                           output_fd);
+    options.checkpointer = checkpointer.get();
+  }
+
+  try {
+    for (size_t i = resuming ? checkpoint.file : 0; i < filenames.size(); ++i) {
+      const std::string &filename = filenames[i];
+      options.resume = resuming && i == checkpoint.file ? &checkpoint : nullptr;
+      if (checkpointer)
+        checkpointer->start_file(i, filename);
+
+      if (input_format == "tokens") {
+        std::unique_ptr<utils::LineReader> in = utils::OpenTokenReader(filename);
+        ProcessTokenized(*in, writer, options);
+      } else {
+        std::unique_ptr<utils::LineReader> in = utils::OpenLineReader(filename);
+        Process(*in, writer, options);
+      }
+    }
+  } catch (...) {
+    // Keep the output of the document pairs aligned before the error
+    writer.finish();
+    throw;
+  }
+
+  writer.finish();
+  if (checkpointer)
+    checkpointer->complete(filenames.size());
+
+  if (print_stats) {
+    align::PruningStats stats = align::GetPruningStats();
+    std::cerr << "Pruned " << stats.pruned << " of " << stats.pairs << " sentence pairs by their lengths" << std::endl;
+  }
 
   return 0;
 }
@@ -0,0 +1,106 @@
+
+#include "src/scorer.h"
+#include "src/utils/common.h"
+#include "src/utils/line_reader.h"
+#include "src/utils/output_writer.h"
+#include "src/utils/compression.h"
+#include "src/utils/tsv_format.h"
+#include "src/utils/token_format.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <boost/make_unique.hpp>
+
+namespace po = boost::program_options;
+
+void Convert(utils::LineReader &in, utils::OutputWriter &writer, const utils::TokenFileHeader &header) {
+  const std::vector<std::string> &split_metadata_headers = header.metadata_fields;
+  std::unordered_map<std::string, int> header_idxs = utils::ReadTsvHeader(in, split_metadata_headers);
+  std::vector<std::string> header_mandatory_fields = utils::GetMandatoryHeaderFields(split_metadata_headers);
+
+  utils::DocumentPair doc_pair;
+  boost::string_ref line;
+  std::vector<boost::string_ref> split_line;
+  size_t n = 0;
+  size_t columns = 0;
+
+  while (in.read_line(line)) {
+    ++n;
+
+    if (columns == 0)
+      columns = utils::CountFields(line);
+
+    utils::ReadDocumentPair(doc_pair, split_line, line, n, columns, header_idxs, header_mandatory_fields,
+                            split_metadata_headers);
+
+    // The same normalization EvalSents applies when aligning from TSV input
+    doc_pair.text1tokens.clear();
+    doc_pair.text2tokens.clear();
+    scorer::normalize(doc_pair.text1tokens, doc_pair.text1translated, header.normalizer);
+    scorer::normalize(doc_pair.text2tokens, doc_pair.translated_text2(), header.normalizer);
+
+    utils::WriteTokenRecord(writer.buffer(), doc_pair, header);
+    writer.document_done();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string metadata_header_fields;
+  std::string output_compression;
+  std::string language_type = "western";
+  std::vector<std::string> filenames;
+
+  po::options_description desc("Allowed options");
+  desc.add_options()
+          ("help", "produce help message")
+          ("metadata-header-fields", po::value(&metadata_header_fields), "language agnostic header fields, comma separated")
+          ("output-compression", po::value(&output_compression), "compress the output with gzip or zstd")
+          ("language-type", po::value(&language_type)->default_value("western"), "western, or cjk to make every Chinese, Japanese or Thai character a token")
+          ("input-file", po::value(&filenames));
+
+  po::positional_options_description positional;
+  positional.add("input-file", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cerr << "Reads bleualign_cpp TSV input from input-files or stdin if none specified, normalizes and tokenizes\n"
+      "the translated columns and writes them to stdout in the binary format bleualign_cpp --input-format tokens reads\n\n" <<
+      "Usage: " << argv[0] << " [--help] [--metadata-header-fields <field1>,...] [--output-compression gzip|zstd]\n"
+      "[--language-type western|cjk] [<input-file>...]\n\n" <<
+      desc << std::endl;
+    return 1;
+  }
+
+  if (language_type != "western" && language_type != "cjk") {
+    std::cerr << "Unknown language type " << language_type << ", expected western or cjk" << std::endl;
+    return 1;
+  }
+
+  utils::TokenFileHeader header;
+  header.normalizer = language_type;
+  utils::SplitString(header.metadata_fields, metadata_header_fields, ',');
+
+  utils::OutputWriter writer(utils::MakeCompressor(utils::ParseCompression(output_compression),
+                                                   boost::make_unique<utils::FdSink>(STDOUT_FILENO)));
+  utils::WriteTokenHeader(writer.buffer(), header);
+
+  if (filenames.empty())
+    filenames.push_back("-");
+
+  for (std::string const &filename : filenames) {
+    std::unique_ptr<utils::LineReader> in = utils::OpenLineReader(filename);
+    Convert(*in, writer, header);
+  }
+
+  writer.finish();
+
+  return 0;
+}
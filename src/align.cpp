@@ -4,252 +4,748 @@
 #include "ngram.h"
 #include "search.h"
 #include "utils/common.h"
+#include "utils/output_writer.h"
 #include "util/murmur_hash.hh"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <boost/make_unique.hpp>
 #include <vector>
 #include <memory>
-#include <iomanip>
+#include <mutex>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
 
 namespace {
-  template <typename T, class Operation> T accumulate_intersection(
-    ngram::ngram_vector::const_iterator lbegin,
-    ngram::ngram_vector::const_iterator lend,
-    ngram::ngram_vector::const_iterator rbegin,
-    ngram::ngram_vector::const_iterator rend, 
-    T first_value,
-    Operation op) {
-    while (lbegin != lend && rbegin != rend) {
-      if (lbegin->first < rbegin->first)
-        ++lbegin;
-      else if (lbegin->first > rbegin->first)
-        ++rbegin;
-      else {
-        first_value = op(first_value, lbegin->second, rbegin->second);
-        ++lbegin;
-        ++rbegin;
-      }
+  // Normalizes every sentence of a document once, so that scoring and the
+  // gap filler only ever look at its token hashes
+  utils::TokenBlock NormalizeDocument(const utils::SentenceBlock &doc, const std::string &language_type) {
+    utils::TokenBlock tokens;
+    scorer::normalize(tokens, doc, language_type);
+    return tokens;
+  }
+
+  void IndexDocument(ngram::DocumentNGramIndex &index, const utils::TokenBlock &doc) {
+    for (size_t i = 0; i < doc.size(); ++i)
+      index.add(doc.sentence_begin(i), doc.sentence_end(i));
+  }
+
+  // The n-gram counts of every sentence of a document, which the gap filler
+  // combines into those of merged sentences
+  std::vector<ngram::NGramCounter> CountSentences(const utils::TokenBlock &doc, unsigned short ngram_size) {
+    std::vector<ngram::NGramCounter> counts;
+    counts.reserve(doc.size());
+    for (size_t i = 0; i < doc.size(); ++i) {
+      counts.emplace_back(ngram_size);
+      counts.back().process(doc.sentence_begin(i), doc.sentence_end(i));
     }
-    return first_value;
+    return counts;
   }
-}
 
-namespace align {
+  void IndexDocument(ngram::DocumentNGramIndex &index, const std::vector<ngram::NGramCounter> &counts) {
+    for (const ngram::NGramCounter &sentence : counts)
+      index.add(sentence);
+  }
 
-    void AlignDocument(const utils::DocumentPair& doc_pair, double threshold, bool print_sent_hash) {
+  // Log of the number of n-grams of each order in a sentence of processed tokens
+  template <unsigned short N>
+  void LogNGramTotals(std::array<double, N> &totals, size_t processed) {
+    for (unsigned short order = 1; order <= N; ++order)
+      totals[order - 1] = log(std::max<int>(processed - order + 1, 0));
+  }
 
-      utils::matches_vec matches;
+  // Sentence pairs looked at and pruned by EvalSents, for GetPruningStats
+  std::atomic<uint64_t> pairs_seen(0);
+  std::atomic<uint64_t> pairs_pruned(0);
+
+  // The score of a pair of sentences from the logs of their numbers of
+  // matching n-grams and of their n-gram totals. False if the score from the
+  // target side is 0, which leaves the pair out of the alternatives.
+  template <unsigned short N>
+  bool PairScore(float &meanscore, const std::array<double, N> &log_correct,
+                 const std::array<double, N> &trg_log_totals, size_t trg_processed,
+                 const std::array<double, N> &src_log_totals, size_t src_processed) {
+    // compute sum of precision scores for ngrams of order 1 to N
+    float logbleu = 0.0;
+    for (unsigned short order = 1; order <= N; ++order)
+      logbleu += float(log_correct[order - 1] - trg_log_totals[order - 1]);
+
+    // apply uniform weights (wn = 1/N)
+    logbleu /= float(N);
+    // brevity penalty
+    logbleu += std::min<float>(0, 1 - static_cast<float>(src_processed) / static_cast<float>(trg_processed));
+
+    float src2trg_score = std::exp(logbleu);
+    if (!(src2trg_score > 0))
+      return false;
+
+    // calculate bleu score in reverse direction
+    logbleu = 0.0;
+    for (unsigned short order = 1; order <= N; ++order)
+      logbleu += float(log_correct[order - 1] - src_log_totals[order - 1]);
+    logbleu /= float(N);
+    logbleu += std::min<float>(0, 1 - static_cast<float>(trg_processed) / static_cast<float>(src_processed));
+    float trg2src_score = std::exp(logbleu);
+    meanscore = (2 * src2trg_score * trg2src_score) / (src2trg_score + trg2src_score);
+    return true;
+  }
 
-      Align(matches, doc_pair.text1translated, doc_pair.text2translated, threshold);
-      WriteAlignedTextToStdout(matches, doc_pair.text1, doc_pair.text2, doc_pair.url1, doc_pair.url2,
-                               doc_pair.text1metadata, doc_pair.text2metadata, print_sent_hash);
+  // Adds the score of target sentence trg_i against source sentence src_i to
+  // its row of scorelist, unless it is 0
+  template <unsigned short N>
+  void ScorePair(utils::CandidateTable &scorelist, const ngram::DocumentNGramIndex &text1translated_ngrams, size_t trg_i,
+                 const std::array<double, N> &trg_log_totals, const ngram::DocumentNGramIndex &src_corpus_ngrams,
+                 size_t src_corpus_i, const std::array<double, N> &src_log_totals) {
+    int correct[N];
+    std::array<double, N> log_correct;
+
+    // a pair without a common n-gram of some order scores 0 and is left out
+    for (unsigned short order = 1; order <= N; ++order) {
+      correct[order - 1] = ngram::intersect_counts(
+        src_corpus_ngrams.keys_begin(src_corpus_i, order), src_corpus_ngrams.keys_end(src_corpus_i, order),
+        src_corpus_ngrams.counts_begin(src_corpus_i, order),
+        text1translated_ngrams.keys_begin(trg_i, order), text1translated_ngrams.keys_end(trg_i, order),
+        text1translated_ngrams.counts_begin(trg_i, order));
+      if (correct[order - 1] == 0)
+        return;
+      log_correct[order - 1] = log(correct[order - 1]);
     }
 
-    void Align(utils::matches_vec &matches, const std::vector<std::string> &text1translated_doc,
-               const std::vector<std::string> &text2translated_doc, double threshold) {
+    float meanscore;
+    if (PairScore<N>(meanscore, log_correct, trg_log_totals, text1translated_ngrams.processed(trg_i),
+                     src_log_totals, src_corpus_ngrams.processed(src_corpus_i)))
+      scorelist.insert(trg_i, meanscore, src_corpus_i, correct);
+  }
 
-      std::vector<utils::scoremap> scorelist;
+  // Upper bounds of the scores of sentence pairs from their lengths alone,
+  // since no more n-grams of an order can match than the shorter sentence
+  // has. They are computed once for every pair of lengths in a document.
+  template <unsigned short N>
+  class ScoreBounds {
+
+  public:
+
+    // Bounds a little above the computed ones, in case the scores of the
+    // pairs round differently
+    static constexpr float slack = 1e-5f;
+
+    explicit ScoreBounds(const ngram::DocumentNGramIndex &src_corpus_ngrams) :
+            src_length_index_(src_corpus_ngrams.size()) {
+      for (size_t i = 0; i < src_corpus_ngrams.size(); ++i)
+        src_lengths_.push_back(src_corpus_ngrams.processed(i));
+      std::sort(src_lengths_.begin(), src_lengths_.end());
+      src_lengths_.erase(std::unique(src_lengths_.begin(), src_lengths_.end()), src_lengths_.end());
+
+      for (size_t i = 0; i < src_corpus_ngrams.size(); ++i)
+        src_length_index_[i] = std::lower_bound(src_lengths_.begin(), src_lengths_.end(),
+                                                src_corpus_ngrams.processed(i)) - src_lengths_.begin();
+      src_log_totals_.resize(src_lengths_.size());
+      for (size_t i = 0; i < src_lengths_.size(); ++i)
+        LogNGramTotals<N>(src_log_totals_[i], src_lengths_[i]);
+    }
 
-      EvalSents(scorelist, text1translated_doc, text2translated_doc, 2, 3);
-      search::FindMatches(matches, scorelist, text1translated_doc.size(), text2translated_doc.size(), float(threshold));
-      GapFiller(matches, text1translated_doc, text2translated_doc, 3, threshold);
+    // The bounds of a target sentence of trg_processed tokens, by source sentence length
+    const std::vector<float> &row(size_t trg_processed, const std::array<double, N> &trg_log_totals) {
+      std::vector<float> &bounds = rows_[trg_processed];
+      if (!bounds.empty() || src_lengths_.empty())
+        return bounds;
+
+      bounds.resize(src_lengths_.size(), 0);
+      for (size_t i = 0; i < src_lengths_.size(); ++i) {
+        // pairs with a sentence without n-grams of order N score 0
+        if (std::min<size_t>(trg_processed, src_lengths_[i]) < N)
+          continue;
+
+        std::array<double, N> log_correct;
+        for (unsigned short order = 1; order <= N; ++order)
+          log_correct[order - 1] = std::min(trg_log_totals[order - 1], src_log_totals_[i][order - 1]);
+        float bound;
+        if (PairScore<N>(bound, log_correct, trg_log_totals, trg_processed, src_log_totals_[i], src_lengths_[i]))
+          bounds[i] = bound + slack;
+      }
+      return bounds;
     }
 
-    /* given list of test sentences and list of reference sentences, calculate bleu scores */
-    void EvalSents(std::vector<utils::scoremap> &scorelist, const std::vector<std::string> &text1translated_doc,
-                   const std::vector<std::string> &text2translated_doc, unsigned short ngram_size, size_t maxalternatives) {
+    float bound(const std::vector<float> &row, size_t src_corpus_i) const {
+      return row[src_length_index_[src_corpus_i]];
+    }
 
-      std::vector<ngram::NGramCounter> src_corpus_ngrams;
-      std::vector<std::string> text_normalized;
+  private:
+    std::vector<size_t> src_lengths_;
+    std::vector<size_t> src_length_index_;
+    std::vector<std::array<double, N>> src_log_totals_;
+    std::unordered_map<size_t, std::vector<float>> rows_;
+
+  };
+
+  template <unsigned short N>
+  constexpr float ScoreBounds<N>::slack;
+
+  // Documents with fewer source sentences are scored exhaustively, which is
+  // cheaper than building their inverted index
+  const size_t min_inverted_sentences = 32;
+
+  // Large documents are split over the threads of SetScoringThreads in
+  // chunks of this many target sentences
+  const size_t parallel_chunk_rows = 64;
+
+  // The threads - 1 helper threads of SetScoringThreads, started once and
+  // shared by all the documents being scored. Each thread aligning or scoring
+  // a document holds one of threads slots while it does, waiting for one if
+  // there is none. Helpers only score while a slot is free and nobody waits
+  // for one, and give it back after every chunk, so no more than threads
+  // threads are ever working at once.
+  class ScoringPool {
+  public:
+    explicit ScoringPool(size_t threads) : slots_(threads) {
+      for (size_t i = 1; i < threads; ++i)
+        helpers_.emplace_back(&ScoringPool::help, this);
+    }
 
-      // Note: score vector moved here from critical section to prevent constant re-allocation
-      std::vector<int> correct(ngram_size, 0);
+    ~ScoringPool() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      work_available_.notify_all();
+      for (std::thread &t : helpers_)
+        t.join();
+    }
 
-      // count ngrams for each sentence of the source corpus
-      for (const std::string &src_sentence : text2translated_doc) {
-        scorer::normalize(text_normalized, src_sentence, "western");
-        ngram::NGramCounter counter(ngram_size);
-        counter.process(text_normalized);
-        src_corpus_ngrams.push_back(counter);
+    void acquire() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++waiting_;
+      slot_available_.wait(lock, [&] { return busy_ < slots_; });
+      --waiting_;
+      ++busy_;
+      peak_ = std::max(peak_, busy_);
+    }
+
+    void release() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --busy_;
       }
+      slot_available_.notify_one();
+      work_available_.notify_one();
+    }
 
-      // for each sentence of the target corpus, compute the bleu score with each sentence of the source
-      // keep <maxalternatives> best options
-      for (const std::string &trg_sentence : text1translated_doc) {
-
-        // tokenize and count ngrams of the target sentence
-        scorer::normalize(text_normalized, trg_sentence, "western");
-        ngram::NGramCounter trg_counts(ngram_size);
-        trg_counts.process(text_normalized);
-
-        utils::scoremap smap;
-
-        // Loop over every source sentence's ngram counts
-        size_t src_corpus_i = 0;
-        for (const ngram::NGramCounter &src_counts : src_corpus_ngrams) {
-          float logbleu = 0.0;
-
-          // compute sum of precision scores for ngrams of order 1 to <ngram_size>
-          for (unsigned short order = 1; order <= ngram_size; ++order) {
-            correct[order - 1] = ::accumulate_intersection(
-              src_counts.cbegin(order), src_counts.cend(order),
-              trg_counts.cbegin(order), trg_counts.cend(order),
-              0,
-              [](size_t acc, size_t src_ngram_freq, size_t trg_ngram_freq) {
-                return acc + std::min(src_ngram_freq, trg_ngram_freq);
-              });
-            logbleu += float(log(correct[order - 1]) - log(std::max<int>(trg_counts.processed() - order + 1, 0)));
-          }
+    // Runs work(false) on the calling thread, which holds a slot, and
+    // work(true) on the helpers that take it up meanwhile, which call
+    // keep_helping before each chunk and return whether chunks are left.
+    // Returns once they all left it.
+    void run(const std::function<bool(bool)> &work) {
+      Job job{&work, 0, false};
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(&job);
+      }
+      work_available_.notify_all();
+      work(false);
 
-          // apply uniform weights (wn = 1/N)
-          logbleu /= float(ngram_size);
-          // brevity penalty
-          logbleu += std::min<float>(0, 1 - static_cast<float>(src_counts.processed()) / static_cast<float>(trg_counts.processed()));
+      std::unique_lock<std::mutex> lock(mutex_);
+      jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+      job_left_.wait(lock, [&] { return job.helpers == 0; });
+    }
 
-          float src2trg_score = std::exp(logbleu);
+    // Whether a helper may score one more chunk, in which case it holds a slot for it
+    bool keep_helping() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (waiting_ > 0 || busy_ >= slots_)
+        return false;
+      ++busy_;
+      peak_ = std::max(peak_, busy_);
+      return true;
+    }
 
-          if (src2trg_score > 0) {
-            // calculate bleu score in reverse direction
-            logbleu = 0.0;
-            for (size_t order = 1; order <= ngram_size; ++order) {
-              logbleu += float(log(correct[order-1]) - log(std::max<int>(src_counts.processed() - order + 1, 0)));
+    size_t peak() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return peak_;
+    }
+
+  private:
+    struct Job {
+      const std::function<bool(bool)> *work;
+      size_t helpers;
+      bool finished;
+    };
+
+    Job *next_job() {
+      for (Job *job : jobs_)
+        if (!job->finished)
+          return job;
+      return nullptr;
+    }
+
+    void help() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (true) {
+        work_available_.wait(lock, [&] { return stop_ || (next_job() && waiting_ == 0 && busy_ < slots_); });
+        if (stop_)
+          return;
+        Job *job = next_job();
+        // the job goes to the back, so that helpers spread over all the documents being scored
+        jobs_.erase(std::find(jobs_.begin(), jobs_.end(), job));
+        jobs_.push_back(job);
+        ++job->helpers;
+        lock.unlock();
+        bool chunks_left = (*job->work)(true);
+        lock.lock();
+        if (!chunks_left)
+          job->finished = true;
+        --job->helpers;
+        job_left_.notify_all();
+      }
+    }
+
+    const size_t slots_;
+    size_t busy_ = 0;
+    size_t waiting_ = 0;
+    size_t peak_ = 0;
+    bool stop_ = false;
+    std::deque<Job *> jobs_;
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable slot_available_;
+    std::condition_variable job_left_;
+    std::vector<std::thread> helpers_;
+  };
+
+  // Only there while SetScoringThreads was given more than 1 thread
+  std::unique_ptr<ScoringPool> scoring_pool;
+
+  // Nesting depth of the calls aligning or scoring a document on this thread,
+  // which hold one slot of scoring_pool between them
+  thread_local size_t scoring_depth = 0;
+
+  class ScoringSlot {
+  public:
+    ScoringSlot() {
+      if (scoring_depth++ == 0 && scoring_pool)
+        scoring_pool->acquire();
+    }
+
+    ~ScoringSlot() {
+      if (--scoring_depth == 0 && scoring_pool)
+        scoring_pool->release();
+    }
+  };
+
+  // EvalSents for n-grams of order 1 to N. With N known at compile time the
+  // order loops are unrolled and the per-order values live on the stack.
+  //
+  // Only pairs sharing an n-gram of order N can score above 0, so every target
+  // sentence is scored against the source sentences that an inverted index
+  // of those n-grams lists for it, in ascending order like the exhaustive
+  // loop. A target sentence with an n-gram in more than a quarter of the
+  // source sentences is scored against all of them instead, which costs
+  // about the same as walking those postings.
+  //
+  // Once a target sentence has maxalternatives alternatives, pairs whose
+  // length bound is below the worst of them are pruned before intersecting
+  // their n-grams. The rows of scorelist hold maxalternatives alternatives,
+  // which keeps the same ones as trimming all scores at the end since the
+  // source sentences are scored in order and of equal scores the later one
+  // ranks first.
+  //
+  // Documents of at least align::min_parallel_pairs sentence pairs have their
+  // target sentences scored on the calling thread and the idle helpers of
+  // scoring_pool, which share the source n-grams and fill their own rows of
+  // scorelist. A row only depends on its target sentence, so scorelist is the
+  // same whatever the threads.
+  template <unsigned short N>
+  void EvalSentsKernel(utils::CandidateTable &scorelist, const ngram::DocumentNGramIndex &text1translated_ngrams,
+                       const ngram::DocumentNGramIndex &src_corpus_ngrams, size_t maxalternatives) {
+
+    size_t src_size = src_corpus_ngrams.size();
+    size_t trg_size = text1translated_ngrams.size();
+
+    // the totals only depend on the sentence lengths, so they are taken once per sentence
+    std::vector<std::array<double, N>> src_log_totals(src_size);
+    for (size_t src_corpus_i = 0; src_corpus_i < src_size; ++src_corpus_i)
+      LogNGramTotals<N>(src_log_totals[src_corpus_i], src_corpus_ngrams.processed(src_corpus_i));
+
+    std::unique_ptr<ngram::InvertedNGramIndex> inverted;
+    if (src_size >= min_inverted_sentences)
+      inverted = boost::make_unique<ngram::InvertedNGramIndex>(src_corpus_ngrams, N);
+    size_t max_postings = src_size / 4;
+
+    // a row never holds more alternatives than there are source sentences
+    scorelist.reset(std::min(maxalternatives, src_size), N);
+    for (size_t trg_i = 0; trg_i < trg_size; ++trg_i)
+      scorelist.add_row();
+
+    std::atomic<size_t> next_row(0);
+
+    // Scores chunks until there are none left, or for a helper until it has
+    // to give its slot back, and returns whether chunks are left
+    auto worker = [&](bool helper) {
+      // candidate_of[i] is 1 + the last target sentence that source sentence i is a candidate of
+      std::vector<size_t> candidate_of(src_size, 0);
+      std::vector<uint32_t> candidates;
+
+      // nothing can be pruned unless there are more source sentences than alternatives
+      std::unique_ptr<ScoreBounds<N>> bounds;
+      if (maxalternatives > 0 && src_size > maxalternatives)
+        bounds = boost::make_unique<ScoreBounds<N>>(src_corpus_ngrams);
+      uint64_t seen = 0, pruned = 0;
+
+      // for each sentence of the target corpus, compute the bleu score with each sentence of the source
+      // keep <maxalternatives> best options
+      while (!helper || scoring_pool->keep_helping()) {
+        size_t first = next_row.fetch_add(parallel_chunk_rows);
+        if (first >= trg_size) {
+          if (helper)
+            scoring_pool->release();
+          break;
+        }
+        for (size_t trg_i = first; trg_i < std::min(first + parallel_chunk_rows, trg_size); ++trg_i) {
+          std::array<double, N> trg_log_totals;
+          LogNGramTotals<N>(trg_log_totals, text1translated_ngrams.processed(trg_i));
+
+          bool exhaustive = !inverted;
+          candidates.clear();
+          for (const uint32_t *key = text1translated_ngrams.keys_begin(trg_i, N);
+               !exhaustive && key != text1translated_ngrams.keys_end(trg_i, N); ++key) {
+            std::pair<const uint32_t *, const uint32_t *> postings = inverted->postings(*key);
+            if (size_t(postings.second - postings.first) > max_postings) {
+              exhaustive = true;
+              break;
+            }
+            for (const uint32_t *sentence = postings.first; sentence != postings.second; ++sentence) {
+              if (candidate_of[*sentence] != trg_i + 1) {
+                candidate_of[*sentence] = trg_i + 1;
+                candidates.push_back(*sentence);
+              }
             }
-            logbleu /= float(ngram_size);
-            logbleu += std::min<float>(0, 1 - static_cast<float>(trg_counts.processed()) / static_cast<float>(src_counts.processed()));
-            float trg2src_score = std::exp(logbleu);
-            float meanscore = (2 * src2trg_score * trg2src_score) / (src2trg_score + trg2src_score);
-            smap.insert(utils::scoremap::value_type(meanscore, std::make_pair(src_corpus_i, correct)));
           }
-          ++src_corpus_i;
-        }
 
-        // keep top N items
-        if (smap.size() > maxalternatives) {
-          auto rem_it = smap.end();
-          std::advance(rem_it, -(maxalternatives));
-          smap.erase(smap.begin(), rem_it);
+          const std::vector<float> *row = nullptr;
+          if (bounds)
+            row = &bounds->row(text1translated_ngrams.processed(trg_i), trg_log_totals);
+
+          auto score = [&](size_t src_corpus_i) {
+            ++seen;
+            if (row && scorelist.full(trg_i) && bounds->bound(*row, src_corpus_i) < scorelist.worst(trg_i)) {
+              ++pruned;
+              return;
+            }
+            ScorePair<N>(scorelist, text1translated_ngrams, trg_i, trg_log_totals, src_corpus_ngrams,
+                         src_corpus_i, src_log_totals[src_corpus_i]);
+          };
+
+          // Both ways go through the one call of score, so that -Ofast cannot
+          // compile them into code that rounds the same pair differently
+          if (!exhaustive)
+            std::sort(candidates.begin(), candidates.end());
+          size_t count = exhaustive ? src_size : candidates.size();
+          for (size_t k = 0; k < count; ++k)
+            score(exhaustive ? k : candidates[k]);
+
+          scorelist.sort(trg_i);
         }
 
-        scorelist.push_back(smap);
+        if (helper)
+          scoring_pool->release();
       }
 
+      pairs_seen += seen;
+      pairs_pruned += pruned;
+      return next_row < trg_size;
+    };
+
+    // the calling thread scores chunks too
+    if (scoring_pool && trg_size * src_size >= align::min_parallel_pairs)
+      scoring_pool->run(worker);
+    else
+      worker(false);
+  }
+
+  // Picks the kernel for the order of the indexes
+  void EvalSentsImpl(utils::CandidateTable &scorelist, const ngram::DocumentNGramIndex &text1translated_ngrams,
+                     const ngram::DocumentNGramIndex &src_corpus_ngrams, size_t maxalternatives) {
+    if (text1translated_ngrams.order() != src_corpus_ngrams.order())
+      throw std::runtime_error("Cannot score n-grams of different orders against each other");
+
+    ScoringSlot slot;
+
+    switch (src_corpus_ngrams.order()) {
+      case 1:
+        EvalSentsKernel<1>(scorelist, text1translated_ngrams, src_corpus_ngrams, maxalternatives);
+        break;
+      case 2:
+        EvalSentsKernel<2>(scorelist, text1translated_ngrams, src_corpus_ngrams, maxalternatives);
+        break;
+      case 3:
+        EvalSentsKernel<3>(scorelist, text1translated_ngrams, src_corpus_ngrams, maxalternatives);
+        break;
+      case 4:
+        EvalSentsKernel<4>(scorelist, text1translated_ngrams, src_corpus_ngrams, maxalternatives);
+        break;
+      default:
+        throw std::runtime_error("Unsupported n-gram order " + std::to_string(src_corpus_ngrams.order()) +
+                                 ", expected 1 to " + std::to_string(align::max_ngram_order));
     }
+  }
 
-    void GapFiller(utils::matches_vec &matched, const std::vector<std::string> &text1translated_doc,
-                   const std::vector<std::string> &text2translated_doc, size_t gap_limit, double threshold) {
+  // First sentence of the merged sentences that end at pos, going back over
+  // unmatched sentences
+  size_t PreGapStart(const std::unique_ptr<int[]> &matches_arr, size_t pos, size_t gap_limit) {
 
-      // check that matches vector contains only 1:1 matches
-      for (auto m: matched) {
-        if (!m.first.same() || !m.second.same())
-          throw std::runtime_error("Inconsistent data in matches!");
-      }
+    int start_post = int(pos) - 1;
+    while (start_post >= 0) {
+      if (matches_arr[start_post] != -1) break;
+      if (start_post < signed(pos) - signed(gap_limit) + 1) break;
+      --start_post;
+    }
+
+    return size_t(start_post + 1);
 
-      std::unique_ptr<int[]> matches_arr_translated = boost::make_unique<int[]>(text1translated_doc.size());
-      std::unique_ptr<int[]> matches_arr_text2 = boost::make_unique<int[]>(text2translated_doc.size());
-      std::fill(matches_arr_translated.get(), matches_arr_translated.get() + text1translated_doc.size(), -1);
-      std::fill(matches_arr_text2.get(), matches_arr_text2.get() + text2translated_doc.size(), -1);
+  }
 
+  // Last sentence of the merged sentences that start at pos, going forward
+  // over unmatched sentences
+  size_t PostGapEnd(const std::unique_ptr<int[]> &matches_arr, size_t matches_arr_size, size_t pos,
+                    size_t gap_limit) {
 
-      for (auto m: matched) {
-        matches_arr_translated[m.first.from] = m.second.from;
-        matches_arr_text2[m.second.from] = m.first.from;
-      }
+    int start_post = int(pos) + 1;
+    while (start_post < signed(matches_arr_size)) {
+      if (matches_arr[start_post] != -1) break;
+      if (start_post > signed(pos) + signed(gap_limit) - 1) break;
+      ++start_post;
+    }
 
-      std::vector<std::string> merged_text_translated;
-      utils::vec_pair merged_pos_translated;
-      std::vector<std::string> merged_text_text2;
-      utils::vec_pair merged_pos_text2;
-
-      for (auto &m: matched) {
-        for (int post = 0; post < 2; ++post) {
-
-          if (post == 0) { // pre
-            PreGapMergedSentences(merged_text_translated, merged_pos_translated, text1translated_doc,
-                                  matches_arr_translated, m.first.from, gap_limit);
-            PreGapMergedSentences(merged_text_text2, merged_pos_text2, text2translated_doc,
-                                  matches_arr_text2, m.second.from, gap_limit);
-          } else if (post == 1) { // post
-            PostGapMergedSentences(merged_text_translated, merged_pos_translated, text1translated_doc,
-                                   matches_arr_translated, text1translated_doc.size(), m.first.from, gap_limit);
-            PostGapMergedSentences(merged_text_text2, merged_pos_text2, text2translated_doc,
-                                   matches_arr_text2, text2translated_doc.size(), m.second.from, gap_limit);
-          }
+    return size_t(start_post - 1);
 
-          if (merged_text_translated.size() == 1 && merged_text_text2.size() == 1)
-            continue;
+  }
 
-          std::vector<utils::scoremap> scorelist;
-          EvalSents(scorelist, merged_text_translated, merged_text_text2, 2, 3);
+  // Merged sentences are scored by appending the n-gram counts of the
+  // sentences they are made of, which were counted once for the whole document
+  void GapFillerImpl(utils::matches_vec &matched, const std::vector<ngram::NGramCounter> &text1translated_doc,
+                     const std::vector<ngram::NGramCounter> &text2translated_doc, size_t gap_limit,
+                     double threshold, unsigned short ngram_size, size_t maxalternatives) {
 
-          // find max
-          float max_val = -1;
-          size_t max_pos_translate;
-          size_t max_pos_text2;
-          for (size_t i = 0; i < scorelist.size(); ++i) {
-            if (scorelist[i].empty()) {
-              continue;
-            }
+    // check that matches vector contains only 1:1 matches
+    for (auto m: matched) {
+      if (!m.first.same() || !m.second.same())
+        throw std::runtime_error("Inconsistent data in matches!");
+    }
 
-            if (scorelist[i].rbegin()->first > max_val && scorelist[i].rbegin()->first > threshold) {
-              max_val = scorelist[i].rbegin()->first;
-              max_pos_translate = i;
-              max_pos_text2 = scorelist[i].rbegin()->second.first;
-            }
+    std::unique_ptr<int[]> matches_arr_translated = boost::make_unique<int[]>(text1translated_doc.size());
+    std::unique_ptr<int[]> matches_arr_text2 = boost::make_unique<int[]>(text2translated_doc.size());
+    std::fill(matches_arr_translated.get(), matches_arr_translated.get() + text1translated_doc.size(), -1);
+    std::fill(matches_arr_text2.get(), matches_arr_text2.get() + text2translated_doc.size(), -1);
+
+
+    for (auto m: matched) {
+      matches_arr_translated[m.first.from] = m.second.from;
+      matches_arr_text2[m.second.from] = m.first.from;
+    }
+
+    std::vector<ngram::NGramCounter> merged_text_translated;
+    utils::vec_pair merged_pos_translated;
+    std::vector<ngram::NGramCounter> merged_text_text2;
+    utils::vec_pair merged_pos_text2;
+    ngram::DocumentNGramIndex merged_ngrams_translated(ngram_size);
+    ngram::DocumentNGramIndex merged_ngrams_text2(ngram_size);
+    utils::CandidateTable scorelist;
+
+    for (auto &m: matched) {
+      for (int post = 0; post < 2; ++post) {
+
+        if (post == 0) { // pre
+          align::ProduceMergedSentences(merged_text_translated, merged_pos_translated, text1translated_doc,
+                                        PreGapStart(matches_arr_translated, m.first.from, gap_limit), m.first.from,
+                                        gap_limit, true);
+          align::ProduceMergedSentences(merged_text_text2, merged_pos_text2, text2translated_doc,
+                                        PreGapStart(matches_arr_text2, m.second.from, gap_limit), m.second.from,
+                                        gap_limit, true);
+        } else if (post == 1) { // post
+          align::ProduceMergedSentences(merged_text_translated, merged_pos_translated, text1translated_doc,
+                                        m.first.from,
+                                        PostGapEnd(matches_arr_translated, text1translated_doc.size(), m.first.from,
+                                                   gap_limit),
+                                        gap_limit, false);
+          align::ProduceMergedSentences(merged_text_text2, merged_pos_text2, text2translated_doc, m.second.from,
+                                        PostGapEnd(matches_arr_text2, text2translated_doc.size(), m.second.from,
+                                                   gap_limit),
+                                        gap_limit, false);
+        }
+
+        if (merged_text_translated.size() == 1 && merged_text_text2.size() == 1)
+          continue;
+
+        merged_ngrams_translated.clear();
+        IndexDocument(merged_ngrams_translated, merged_text_translated);
+        merged_ngrams_text2.clear();
+        IndexDocument(merged_ngrams_text2, merged_text_text2);
+
+        EvalSentsImpl(scorelist, merged_ngrams_translated, merged_ngrams_text2, maxalternatives);
+
+        // find max
+        float max_val = -1;
+        size_t max_pos_translate;
+        size_t max_pos_text2;
+        for (size_t i = 0; i < scorelist.rows(); ++i) {
+          if (scorelist.empty(i)) {
+            continue;
           }
 
-          // update match
-          if (max_val != -1) {
-            m = utils::match(
-                    merged_pos_translated[max_pos_translate].first,
-                    merged_pos_translated[max_pos_translate].second,
-                    merged_pos_text2[max_pos_text2].first,
-                    merged_pos_text2[max_pos_text2].second, max_val);
+          const utils::CandidateTable::Candidate &best = *scorelist.begin(i);
+          if (best.score > max_val && best.score > threshold) {
+            max_val = best.score;
+            max_pos_translate = i;
+            max_pos_text2 = best.index;
           }
+        }
 
+        // update match
+        if (max_val != -1) {
+          m = utils::match(
+                  merged_pos_translated[max_pos_translate].first,
+                  merged_pos_translated[max_pos_translate].second,
+                  merged_pos_text2[max_pos_text2].first,
+                  merged_pos_text2[max_pos_text2].second, max_val);
+        }
 
-          FillMatches(matches_arr_translated, matches_arr_text2, m);
 
-        }
+        align::FillMatches(matches_arr_translated, matches_arr_text2, m);
+
       }
+    }
+
+  }
 
+  void AlignImpl(utils::matches_vec &matches, const utils::TokenBlock &text1tokens,
+                 const utils::TokenBlock &text2tokens, double threshold, unsigned short ngram_size,
+                 size_t maxalternatives) {
 
+    utils::CandidateTable scorelist;
+
+    // Scoring and the gap filler use the same n-grams, so the sentences are counted once
+    std::vector<ngram::NGramCounter> text1counts = CountSentences(text1tokens, ngram_size);
+    std::vector<ngram::NGramCounter> text2counts = CountSentences(text2tokens, ngram_size);
+    ngram::DocumentNGramIndex text1ngrams(ngram_size), text2ngrams(ngram_size);
+    IndexDocument(text1ngrams, text1counts);
+    IndexDocument(text2ngrams, text2counts);
+
+    EvalSentsImpl(scorelist, text1ngrams, text2ngrams, maxalternatives);
+    search::FindMatches(matches, scorelist, text1tokens.size(), text2tokens.size(), float(threshold));
+    GapFillerImpl(matches, text1counts, text2counts, 3, threshold, ngram_size, maxalternatives);
+  }
+}
+
+namespace align {
+
+    void AlignDocument(utils::matches_vec &matches, const utils::DocumentPair &doc_pair, double threshold,
+                       const std::string &language_type, unsigned short ngram_size, size_t maxalternatives) {
+      ScoringSlot slot;
+      if (doc_pair.pretokenized)
+        Align(matches, doc_pair.text1tokens, doc_pair.text2tokens, threshold, ngram_size, maxalternatives);
+      else
+        Align(matches, doc_pair.text1translated, doc_pair.translated_text2(), threshold, language_type, ngram_size,
+              maxalternatives);
     }
 
-    void PreGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                               const std::vector<std::string> &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
-                               size_t gap_limit) {
+    void Align(utils::matches_vec &matches, const utils::SentenceBlock &text1translated_doc,
+               const utils::SentenceBlock &text2translated_doc, double threshold, const std::string &language_type,
+               unsigned short ngram_size, size_t maxalternatives) {
+      AlignImpl(matches, NormalizeDocument(text1translated_doc, language_type),
+                NormalizeDocument(text2translated_doc, language_type), threshold, ngram_size, maxalternatives);
+    }
 
-      int start_post = int(pos) - 1;
-      while (start_post >= 0) {
-        if (matches_arr[start_post] != -1) break;
-        if (start_post < signed(pos) - signed(gap_limit) + 1) break;
-        --start_post;
-      }
+    void Align(utils::matches_vec &matches, const utils::TokenBlock &text1tokens,
+               const utils::TokenBlock &text2tokens, double threshold, unsigned short ngram_size,
+               size_t maxalternatives) {
+      AlignImpl(matches, text1tokens, text2tokens, threshold, ngram_size, maxalternatives);
+    }
 
-      ProduceMergedSentences(merged_text, merged_pos, docs, start_post + 1, pos, gap_limit, true);
+    /* given list of test sentences and list of reference sentences, calculate bleu scores */
+    void EvalSents(utils::CandidateTable &scorelist, const utils::SentenceBlock &text1translated_doc,
+                   const utils::SentenceBlock &text2translated_doc, unsigned short ngram_size, size_t maxalternatives,
+                   const std::string &language_type) {
+      EvalSents(scorelist, NormalizeDocument(text1translated_doc, language_type),
+                NormalizeDocument(text2translated_doc, language_type), ngram_size, maxalternatives);
+    }
 
+    void EvalSents(utils::CandidateTable &scorelist, const utils::TokenBlock &text1tokens,
+                   const utils::TokenBlock &text2tokens, unsigned short ngram_size, size_t maxalternatives) {
+      ngram::DocumentNGramIndex text1ngrams(ngram_size), text2ngrams(ngram_size);
+      IndexDocument(text1ngrams, text1tokens);
+      IndexDocument(text2ngrams, text2tokens);
+      EvalSentsImpl(scorelist, text1ngrams, text2ngrams, maxalternatives);
     }
 
+    void EvalSents(utils::CandidateTable &scorelist, const std::vector<ngram::NGramCounter> &text1counts,
+                   const std::vector<ngram::NGramCounter> &text2counts, unsigned short ngram_size,
+                   size_t maxalternatives) {
+      ngram::DocumentNGramIndex text1ngrams(ngram_size), text2ngrams(ngram_size);
+      IndexDocument(text1ngrams, text1counts);
+      IndexDocument(text2ngrams, text2counts);
+      EvalSentsImpl(scorelist, text1ngrams, text2ngrams, maxalternatives);
+    }
 
-    void PostGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                                const std::vector<std::string> &docs, std::unique_ptr<int[]> &matches_arr,
-                                size_t matches_arr_size, size_t pos, size_t gap_limit) {
+    void EvalSents(utils::CandidateTable &scorelist, const ngram::DocumentNGramIndex &text1ngrams,
+                   const ngram::DocumentNGramIndex &text2ngrams, size_t maxalternatives) {
+      EvalSentsImpl(scorelist, text1ngrams, text2ngrams, maxalternatives);
+    }
 
-      int start_post = int(pos) + 1;
-      while (start_post < signed(matches_arr_size)) {
-        if (matches_arr[start_post] != -1) break;
-        if (start_post > signed(pos) + signed(gap_limit) - 1) break;
-        ++start_post;
-      }
+    void SetScoringThreads(size_t threads) {
+      scoring_pool.reset();
+      if (threads > 1)
+        scoring_pool = boost::make_unique<ScoringPool>(threads);
+    }
+
+    size_t GetPeakScoringThreads() {
+      return scoring_pool ? scoring_pool->peak() : 1;
+    }
 
-      ProduceMergedSentences(merged_text, merged_pos, docs, pos, start_post - 1, gap_limit, false);
+    PruningStats GetPruningStats() {
+      PruningStats stats;
+      stats.pairs = pairs_seen;
+      stats.pruned = pairs_pruned;
+      return stats;
+    }
 
+    void GapFiller(utils::matches_vec &matched, const utils::SentenceBlock &text1translated_doc,
+                   const utils::SentenceBlock &text2translated_doc, size_t gap_limit, double threshold,
+                   const std::string &language_type, unsigned short ngram_size, size_t maxalternatives) {
+      GapFiller(matched, NormalizeDocument(text1translated_doc, language_type),
+                NormalizeDocument(text2translated_doc, language_type), gap_limit, threshold, ngram_size,
+                maxalternatives);
+    }
+
+    void GapFiller(utils::matches_vec &matched, const utils::TokenBlock &text1tokens,
+                   const utils::TokenBlock &text2tokens, size_t gap_limit, double threshold,
+                   unsigned short ngram_size, size_t maxalternatives) {
+      GapFillerImpl(matched, CountSentences(text1tokens, ngram_size), CountSentences(text2tokens, ngram_size),
+                    gap_limit, threshold, ngram_size, maxalternatives);
+    }
+
+    void PreGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
+                               const utils::SentenceBlock &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
+                               size_t gap_limit) {
+      ProduceMergedSentences(merged_text, merged_pos, docs, PreGapStart(matches_arr, pos, gap_limit), pos, gap_limit,
+                             true);
+    }
+
+
+    void PostGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
+                                const utils::SentenceBlock &docs, std::unique_ptr<int[]> &matches_arr,
+                                size_t matches_arr_size, size_t pos, size_t gap_limit) {
+      ProduceMergedSentences(merged_text, merged_pos, docs, pos,
+                             PostGapEnd(matches_arr, matches_arr_size, pos, gap_limit), gap_limit, false);
     }
 
 
     void ProduceMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                                const std::vector<std::string> &docs, size_t from, size_t to, size_t limit,
+                                const utils::SentenceBlock &docs, size_t from, size_t to, size_t limit,
                                 bool reverse) {
       merged_text.clear();
       merged_pos.clear();
@@ -284,6 +780,36 @@ namespace align {
     }
 
 
+    void ProduceMergedSentences(std::vector<ngram::NGramCounter> &merged_counts, utils::vec_pair &merged_pos,
+                                const std::vector<ngram::NGramCounter> &counts, size_t from, size_t to, size_t limit,
+                                bool reverse) {
+      merged_counts.clear();
+      merged_pos.clear();
+
+      // Each merged sentence grows the previous one by a sentence, so only the
+      // n-grams across the new boundary are counted
+      size_t limited_end = std::min(limit, to - from + 1);
+      merged_counts.reserve(limited_end);
+      for (size_t i = 0; i < limited_end; ++i) {
+        size_t first = reverse ? to - i : from;
+        size_t last = reverse ? to : from + i;
+
+        if (i == 0) {
+          merged_counts.push_back(counts[first]);
+        } else if (reverse) {
+          merged_counts.push_back(counts[first]);
+          merged_counts.back().append(merged_counts[i - 1]);
+        } else {
+          merged_counts.push_back(merged_counts[i - 1]);
+          merged_counts.back().append(counts[last]);
+        }
+
+        merged_pos.push_back(std::make_pair(first, last));
+      }
+
+    }
+
+
     void FillMatches(std::unique_ptr<int[]> &arr1, std::unique_ptr<int[]> &arr2, utils::match m) {
       for (size_t i = m.first.from; i <= m.first.to; ++i) {
         arr1[i] = m.second.from;
@@ -294,72 +820,86 @@ namespace align {
       }
     }
 
-    void WriteAlignedTextToStdout(const utils::matches_vec &matches,
-                                  const std::vector<std::string> &text1_doc,
-                                  const std::vector<std::string> &text2_doc,
-                                  const std::string& url1,
-                                  const std::string& url2,
-                                  const std::vector<std::vector<std::string>> &text1_metadata,
-                                  const std::vector<std::vector<std::string>> &text2_metadata,
-                                  const bool print_sent_hash) {
+    void WriteAlignedText(std::string &out,
+                          const utils::matches_vec &matches,
+                          const utils::SentenceBlock &text1_doc,
+                          const utils::SentenceBlock &text2_doc,
+                          const std::string& url1,
+                          const std::string& url2,
+                          const std::vector<std::vector<std::string>> &text1_metadata,
+                          const std::vector<std::vector<std::string>> &text2_metadata,
+                          const bool print_sent_hash) {
       for (auto m: matches) {
-        std::cout << url1 << "\t" << url2 << "\t";
+        out.append(url1).append(1, '\t').append(url2).append(1, '\t');
 
         // print sentences (matches)
 
         for (size_t i = m.first.from; i < m.first.to; ++i) {
-          std::cout << text1_doc[i] << ' ';
+          out.append(text1_doc[i].data(), text1_doc[i].size()).append(1, ' ');
         }
-        std::cout << text1_doc[m.first.to] << "\t";
+        out.append(text1_doc[m.first.to].data(), text1_doc[m.first.to].size()).append(1, '\t');
 
         for (size_t i = m.second.from; i < m.second.to; ++i) {
-          std::cout << text2_doc[i] << ' ';
+          out.append(text2_doc[i].data(), text2_doc[i].size()).append(1, ' ');
         }
-        std::cout << text2_doc[m.second.to] << "\t";
+        out.append(text2_doc[m.second.to].data(), text2_doc[m.second.to].size()).append(1, '\t');
 
-        std::cout << std::fixed << std::setprecision(6) << m.score;
+        utils::AppendFixed6(out, m.score);
 
         if (print_sent_hash) {
-          std::cout << "\t";
+          out.append(1, '\t');
 
           for (size_t i = m.first.from; i < m.first.to; ++i) {
-            std::cout << std::hex << util::MurmurHashNative(text1_doc[i].c_str(), text1_doc[i].size(), 0) << '+';
+            utils::AppendHex(out, util::MurmurHashNative(text1_doc[i].data(), text1_doc[i].size(), 0));
+            out.append(1, '+');
           }
-          std::cout << std::hex << util::MurmurHashNative(text1_doc[m.first.to].c_str(), text1_doc[m.first.to].size(), 0) << "\t";
+          utils::AppendHex(out, util::MurmurHashNative(text1_doc[m.first.to].data(), text1_doc[m.first.to].size(), 0));
+          out.append(1, '\t');
 
           for (size_t i = m.second.from; i < m.second.to; ++i) {
-            std::cout << std::hex << util::MurmurHashNative(text2_doc[i].c_str(), text2_doc[i].size(), 0) << '+';
+            utils::AppendHex(out, util::MurmurHashNative(text2_doc[i].data(), text2_doc[i].size(), 0));
+            out.append(1, '+');
           }
-          std::cout << std::hex << util::MurmurHashNative(text2_doc[m.second.to].c_str(), text2_doc[m.second.to].size(), 0);
+          utils::AppendHex(out, util::MurmurHashNative(text2_doc[m.second.to].data(), text2_doc[m.second.to].size(), 0));
         }
 
         // Print metadata
         if (text1_metadata.size() > 0) {
           for (size_t i = 0; i < text1_metadata[0].size(); ++i) {
-            std::string metadata = "";
+            out.append(1, '\t');
 
             for (size_t j = m.first.from; j < m.first.to; ++j) {
-              metadata += text1_metadata[j][i] + "+";
+              out.append(text1_metadata[j][i]).append(1, '+');
             }
 
-            metadata += text1_metadata[m.first.to][i];
+            out.append(text1_metadata[m.first.to][i]);
 
-            std::cout << "\t" << metadata;
-
-            metadata = "";
+            out.append(1, '\t');
 
             for (size_t j = m.second.from; j < m.second.to; ++j) {
-              metadata += text2_metadata[j][i] + "+";
+              out.append(text2_metadata[j][i]).append(1, '+');
             }
 
-            metadata += text2_metadata[m.second.to][i];
-
-            std::cout << "\t" << metadata;
+            out.append(text2_metadata[m.second.to][i]);
           }
         }
 
-        std::cout << "\n";
+        out.append(1, '\n');
       }
     }
 
+    void WriteAlignedTextToStdout(const utils::matches_vec &matches,
+                                  const utils::SentenceBlock &text1_doc,
+                                  const utils::SentenceBlock &text2_doc,
+                                  const std::string& url1,
+                                  const std::string& url2,
+                                  const std::vector<std::vector<std::string>> &text1_metadata,
+                                  const std::vector<std::vector<std::string>> &text2_metadata,
+                                  const bool print_sent_hash) {
+      std::string out;
+      WriteAlignedText(out, matches, text1_doc, text2_doc, url1, url2, text1_metadata, text2_metadata,
+                       print_sent_hash);
+      std::cout.write(out.data(), out.size());
+    }
+
 } // namespace align
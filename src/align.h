@@ -4,41 +4,124 @@
 
 
 #include "search.h"
+#include "ngram.h"
 #include "utils/common.h"
 
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <vector>
 
 namespace align {
 
-    void AlignDocument(const utils::DocumentPair& doc_pair, double threshold, bool print_sent_hash);
-
-    void Align(utils::matches_vec &matches, const std::vector<std::string> &text1translated_doc,
-               const std::vector<std::string> &text2_doc, double threshold);
-
-    void EvalSents(std::vector<utils::scoremap> &scorelist, const std::vector<std::string> &text1translated_doc,
-                   const std::vector<std::string> &text2_doc, unsigned short ngram_size, size_t maxalternatives);
-
-    void GapFiller(utils::matches_vec &matched, const std::vector<std::string> &text1translated_doc,
-                   const std::vector<std::string> &text2_doc, size_t gap_limit, double threshold);
-
+    // EvalSents has kernels for n-grams of order 1 to max_ngram_order
+    const unsigned short max_ngram_order = 4;
+
+    // What Align scores sentences with unless told otherwise: bigram BLEU,
+    // keeping the best 3 source sentences of every target sentence
+    const unsigned short default_ngram_size = 2;
+    const size_t default_max_alternatives = 3;
+
+    // EvalSents splits documents of at least this many sentence pairs over
+    // the idle threads of SetScoringThreads
+    const size_t min_parallel_pairs = size_t(1) << 22;
+
+    // Aligns the translated sentences of doc_pair, normalized for language_type,
+    // or its tokens when it is pretokenized, without looking at the columns that
+    // are only printed
+    void AlignDocument(utils::matches_vec &matches, const utils::DocumentPair &doc_pair, double threshold,
+                       const std::string &language_type = "western",
+                       unsigned short ngram_size = default_ngram_size,
+                       size_t maxalternatives = default_max_alternatives);
+
+    void Align(utils::matches_vec &matches, const utils::SentenceBlock &text1translated_doc,
+               const utils::SentenceBlock &text2_doc, double threshold,
+               const std::string &language_type = "western", unsigned short ngram_size = default_ngram_size,
+               size_t maxalternatives = default_max_alternatives);
+
+    void Align(utils::matches_vec &matches, const utils::TokenBlock &text1tokens,
+               const utils::TokenBlock &text2tokens, double threshold, unsigned short ngram_size = default_ngram_size,
+               size_t maxalternatives = default_max_alternatives);
+
+    void EvalSents(utils::CandidateTable &scorelist, const utils::SentenceBlock &text1translated_doc,
+                   const utils::SentenceBlock &text2_doc, unsigned short ngram_size, size_t maxalternatives,
+                   const std::string &language_type = "western");
+
+    void EvalSents(utils::CandidateTable &scorelist, const utils::TokenBlock &text1tokens,
+                   const utils::TokenBlock &text2tokens, unsigned short ngram_size, size_t maxalternatives);
+
+    // Scores sentences already counted with NGramCounters of ngram_size
+    void EvalSents(utils::CandidateTable &scorelist, const std::vector<ngram::NGramCounter> &text1counts,
+                   const std::vector<ngram::NGramCounter> &text2counts, unsigned short ngram_size,
+                   size_t maxalternatives);
+
+    // Scores the sentences of two indexes of the same order against each other.
+    // Like the other overloads, throws for orders above max_ngram_order.
+    void EvalSents(utils::CandidateTable &scorelist, const ngram::DocumentNGramIndex &text1ngrams,
+                   const ngram::DocumentNGramIndex &text2ngrams, size_t maxalternatives);
+
+    // Sentence pairs that EvalSents looked at since the program started, and
+    // how many of them it pruned because their lengths alone kept them below
+    // the alternatives it had already found
+    struct PruningStats {
+        uint64_t pairs = 0;
+        uint64_t pruned = 0;
+    };
+
+    PruningStats GetPruningStats();
+
+    // Number of threads that align documents and score their sentences at
+    // once, 1 unless set. Above 1, every thread in AlignDocument or EvalSents
+    // takes one of them, waiting for one if there is none, and large documents
+    // are scored on those left idle. The scores are the same whatever the
+    // number. Not to be called while documents are being aligned.
+    void SetScoringThreads(size_t threads);
+
+    // Most threads that aligned or scored at once since SetScoringThreads,
+    // which is never more than it was given
+    size_t GetPeakScoringThreads();
+
+    // Normalizes the sentences of both documents once and fills the gaps with their tokens
+    void GapFiller(utils::matches_vec &matched, const utils::SentenceBlock &text1translated_doc,
+                   const utils::SentenceBlock &text2_doc, size_t gap_limit, double threshold,
+                   const std::string &language_type = "western", unsigned short ngram_size = default_ngram_size,
+                   size_t maxalternatives = default_max_alternatives);
+
+    void GapFiller(utils::matches_vec &matched, const utils::TokenBlock &text1tokens,
+                   const utils::TokenBlock &text2tokens, size_t gap_limit, double threshold,
+                   unsigned short ngram_size = default_ngram_size, size_t maxalternatives = default_max_alternatives);
+
+    // Joins the merged sentences into strings. GapFiller combines the n-gram
+    // counts of the sentences instead, with the NGramCounter overload.
     void ProduceMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                                const std::vector<std::string> &docs, size_t from, size_t to, size_t limit,
+                                const utils::SentenceBlock &docs, size_t from, size_t to, size_t limit,
+                                bool reverse = false);
+
+    // Counts of the merged sentences, each made by appending one sentence to
+    // the previous one
+    void ProduceMergedSentences(std::vector<ngram::NGramCounter> &merged_counts, utils::vec_pair &merged_pos,
+                                const std::vector<ngram::NGramCounter> &counts, size_t from, size_t to, size_t limit,
                                 bool reverse = false);
 
     void PreGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                               const std::vector<std::string> &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
+                               const utils::SentenceBlock &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
                                size_t gap_limit);
 
     void PostGapMergedSentences(std::vector<std::string> &merged_text, utils::vec_pair &merged_pos,
-                                const std::vector<std::string> &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
+                                const utils::SentenceBlock &docs, std::unique_ptr<int[]> &matches_arr, size_t pos,
                                 size_t matches_arr_size, size_t gap_limit);
 
     void FillMatches(std::unique_ptr<int[]> &arr1, std::unique_ptr<int[]> &arr2, utils::match m);
 
-    void WriteAlignedTextToStdout(const utils::matches_vec &matches, const std::vector<std::string> &text1_doc,
-                                  const std::vector<std::string> &text2_doc, const std::string& url1, const std::string& url2,
+    void WriteAlignedText(std::string &out, const utils::matches_vec &matches,
+                          const utils::SentenceBlock &text1_doc, const utils::SentenceBlock &text2_doc,
+                          const std::string& url1, const std::string& url2,
+                          const std::vector<std::vector<std::string>> &text1_metadata,
+                          const std::vector<std::vector<std::string>> &text2_metadata,
+                          const bool print_sent_hash);
+
+    void WriteAlignedTextToStdout(const utils::matches_vec &matches, const utils::SentenceBlock &text1_doc,
+                                  const utils::SentenceBlock &text2_doc, const std::string& url1, const std::string& url2,
                                   const std::vector<std::vector<std::string>> &text1_metadata,
                                   const std::vector<std::vector<std::string>> &text2_metadata,
                                   const bool print_sent_hash);
@@ -4,27 +4,89 @@
 #include <string>
 #include <vector>
 #include <numeric>
-#include <algorithm> 
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace {
-  typedef std::vector<std::string>::const_iterator token_iterator;
-
-  size_t increment_helper(std::vector<token_iterator> const &token_iterators,
-                   unsigned short ngram,
-                   std::vector<ngram::ngram_map> &maps) {
-    size_t hash = 0;
-    for (unsigned short i = 1; i <= ngram; ++i){
-      hash = ngram::get_token_hash(*token_iterators[ngram-i], hash);
-      maps[i - 1][hash] += 1;
+  // One side of an intersection is galloped through when the other one is
+  // this many times shorter
+  const size_t gallop_ratio = 16;
+
+  // intersect_counts for a short range, looking up each of its keys in the
+  // long one with an exponential search
+  uint32_t gallop_counts(const uint32_t *skeys, const uint32_t *send, const uint32_t *scounts,
+                         const uint32_t *lkeys, const uint32_t *lend, const uint32_t *lcounts) {
+    uint32_t correct = 0;
+    const uint32_t *lbegin = lkeys;
+    for (; skeys != send && lkeys != lend; ++skeys, ++scounts) {
+      // Keys before lkeys + low are smaller, the one at lkeys + high is not
+      size_t size = lend - lkeys;
+      size_t low = 0;
+      size_t high = 0;
+      for (size_t step = 1; high < size && lkeys[high] < *skeys; step *= 2) {
+        low = high + 1;
+        high += step;
+      }
+      lkeys = std::lower_bound(lkeys + low, lkeys + std::min(high + 1, size), *skeys);
+      if (lkeys != lend && *lkeys == *skeys)
+        correct += std::min(*scounts, lcounts[lkeys - lbegin]);
+    }
+    return correct;
+  }
+
+  // Sorts the (key, 1) pairs of every order and collapses equal keys into
+  // their count, in place
+  void sort_counts(std::vector<ngram::ngram_vector> &data) {
+    for (ngram::ngram_vector &counts : data) {
+      if (counts.empty())
+        continue;
+      std::sort(counts.begin(), counts.end());
+      auto out = counts.begin();
+      for (auto it = counts.begin() + 1; it != counts.end(); ++it) {
+        if (it->first == out->first)
+          out->second += it->second;
+        else
+          *++out = *it;
+      }
+      counts.erase(out + 1, counts.end());
+    }
+  }
+
+  // Adds the counts of b to a, both sorted by key. Keys may repeat in b.
+  void merge_counts(ngram::ngram_vector &a, const ngram::ngram_vector &b, ngram::ngram_vector &scratch) {
+    scratch.clear();
+    scratch.reserve(a.size() + b.size());
+    auto add = [&](const ngram::ngram_pair &pair) {
+      if (!scratch.empty() && scratch.back().first == pair.first)
+        scratch.back().second += pair.second;
+      else
+        scratch.push_back(pair);
+    };
+
+    auto ai = a.cbegin(), bi = b.cbegin();
+    while (ai != a.cend() && bi != b.cend()) {
+      if (bi->first < ai->first)
+        add(*bi++);
+      else
+        add(*ai++);
     }
-    return ngram; // number of iterations of the for-loop
+    std::for_each(ai, a.cend(), add);
+    std::for_each(bi, b.cend(), add);
+    a.swap(scratch);
   }
+
 }
 
 
 namespace ngram {
-  size_t get_token_hash(const std::string &token, size_t seed){
-    return util::MurmurHashNative(token.c_str(), token.size(), seed);
+  size_t get_token_hash(boost::string_ref token, size_t seed){
+    return util::MurmurHashNative(token.data(), token.size(), seed);
+  }
+
+  size_t get_token_hash(uint64_t token_hash, size_t seed){
+    return util::MurmurHashNative(&token_hash, sizeof(token_hash), seed);
   }
 
   NGramCounter::NGramCounter(unsigned short n) : ngram_size_(n) {
@@ -41,47 +103,234 @@ namespace ngram {
   }
 
   void NGramCounter::process(std::vector<std::string> const &tokens) {
-    data_.clear();
     data_.resize(ngram_size_);
-    
-    total_freq_ = 0;
+    head_.clear();
+    tail_.clear();
+
     tokens_processed_ = tokens.size();
+    total_freq_ = 0;
+    for (unsigned short order = 1; order <= ngram_size_; ++order) {
+      data_[order - 1].clear();
+      if (order <= tokens_processed_)
+        data_[order - 1].reserve(tokens_processed_ - order + 1);
+    }
+
+    // Every n-gram is keyed from its last token backwards
+    for (size_t last = 0; last < tokens.size(); ++last) {
+      size_t hash = 0;
+      for (size_t order = 1; order <= ngram_size_ && order <= last + 1; ++order) {
+        hash = get_token_hash(tokens[last + 1 - order], hash);
+        data_[order - 1].push_back(ngram_pair(hash, 1));
+        ++total_freq_;
+      }
+    }
+
+    ::sort_counts(data_);
+  }
+
+  void NGramCounter::process(const uint64_t *begin, const uint64_t *end) {
+    data_.resize(ngram_size_);
+
+    tokens_processed_ = end - begin;
+    total_freq_ = 0;
+    for (unsigned short order = 1; order <= ngram_size_; ++order) {
+      data_[order - 1].clear();
+      if (order <= tokens_processed_)
+        data_[order - 1].reserve(tokens_processed_ - order + 1);
+    }
 
-    if (tokens.empty())
-      return;
+    size_t boundary = std::min<size_t>(tokens_processed_, ngram_size_ - 1);
+    head_.assign(begin, begin + boundary);
+    tail_.assign(end - boundary, end);
 
-    // Set up hash maps
-    std::vector<ngram_map> maps(ngram_size_);
+    // Unigram keys are the token hashes, longer n-grams extend the key of the
+    // one a token shorter from their last token backwards
+    for (const uint64_t *last = begin; last != end; ++last) {
+      size_t hash = *last;
+      data_[0].push_back(ngram_pair(hash, 1));
+      ++total_freq_;
+      for (size_t order = 2; order <= ngram_size_ && order <= size_t(last - begin) + 1; ++order) {
+        hash = get_token_hash(*(last - order + 1), hash);
+        data_[order - 1].push_back(ngram_pair(hash, 1));
+        ++total_freq_;
+      }
+    }
+
+    ::sort_counts(data_);
+  }
+
+  void NGramCounter::append(const NGramCounter &right) {
+    // The n-grams that start in tail_ and end in right.head_. Like in
+    // process(), the key of an n-gram is the hash of its last token, extended
+    // by get_token_hash with each token before it
+    std::vector<uint64_t> joint(tail_);
+    joint.insert(joint.end(), right.head_.begin(), right.head_.end());
+    size_t split = tail_.size();
+
+    std::vector<ngram_vector> across(ngram_size_);
+    for (size_t last = split; last < joint.size(); ++last) {
+      size_t hash = joint[last];
+      for (size_t order = 2; order <= ngram_size_ && order <= last + 1; ++order) {
+        size_t first = last + 1 - order;
+        hash = get_token_hash(joint[first], hash);
+        if (first < split) {
+          across[order - 1].push_back(ngram_pair(hash, 1));
+          ++total_freq_;
+        }
+      }
+    }
 
-    // set-up iterators
-    std::vector<::token_iterator> token_iterators(ngram_size_);
+    ngram_vector scratch;
+    for (size_t i = 0; i < ngram_size_; ++i) {
+      merge_counts(data_[i], right.data_[i], scratch);
+      std::sort(across[i].begin(), across[i].end());
+      merge_counts(data_[i], across[i], scratch);
+    }
+
+    // A side shorter than n - 1 tokens is entirely in its head and tail
+    size_t boundary = ngram_size_ - 1;
+    for (size_t i = 0; i < right.head_.size() && head_.size() < boundary; ++i)
+      head_.push_back(right.head_[i]);
+    tail_.insert(tail_.end(), right.tail_.begin(), right.tail_.end());
+    if (tail_.size() > boundary)
+      tail_.erase(tail_.begin(), tail_.end() - boundary);
+
+    total_freq_ += right.total_freq_;
+    tokens_processed_ += right.tokens_processed_;
+  }
+
+  DocumentNGramIndex::DocumentNGramIndex(unsigned short n) : ngram_size_(n), offsets_(1, 0), counter_(n) {
+  }
 
-    for (unsigned short i = 0; i < ngram_size_; ++i) {
-      token_iterators[i] = tokens.begin();
-      std::advance(token_iterators[i], i);
+  void DocumentNGramIndex::add(const NGramCounter &counter) {
+    for (unsigned short ngram = 1; ngram <= ngram_size_; ++ngram) {
+      // The counter keys are sorted, so their high bits are too and keys
+      // that collide in them are next to each other
+      size_t start = keys_.size();
+      for (auto it = counter.cbegin(ngram); it != counter.cend(ngram); ++it) {
+        uint32_t key = uint32_t(it->first >> 32);
+        if (keys_.size() > start && keys_.back() == key) {
+          counts_.back() += uint32_t(it->second);
+        } else {
+          keys_.push_back(key);
+          counts_.push_back(uint32_t(it->second));
+        }
+      }
+      offsets_.push_back(keys_.size());
     }
+    processed_.push_back(uint32_t(counter.processed()));
+  }
+
+  void DocumentNGramIndex::add(const uint64_t *begin, const uint64_t *end) {
+    counter_.process(begin, end);
+    add(counter_);
+  }
 
-    // base
-    for (unsigned short i = 1; i < ngram_size_; ++i) {
-      total_freq_ += ::increment_helper(token_iterators, i, maps);
+  void DocumentNGramIndex::clear() {
+    keys_.clear();
+    counts_.clear();
+    offsets_.resize(1);
+    processed_.clear();
+  }
+
+  uint32_t intersect_counts_scalar(const uint32_t *lkeys, const uint32_t *lend, const uint32_t *lcounts,
+                                   const uint32_t *rkeys, const uint32_t *rend, const uint32_t *rcounts) {
+    uint32_t correct = 0;
+    while (lkeys != lend && rkeys != rend) {
+      if (*lkeys < *rkeys) {
+        ++lkeys;
+        ++lcounts;
+      } else if (*lkeys > *rkeys) {
+        ++rkeys;
+        ++rcounts;
+      } else {
+        correct += std::min(*lcounts, *rcounts);
+        ++lkeys;
+        ++lcounts;
+        ++rkeys;
+        ++rcounts;
+      }
     }
+    return correct;
+  }
 
-    // continue
-    while (token_iterators[ngram_size_ - 1] != tokens.end()) {
-      total_freq_ += ::increment_helper(token_iterators, ngram_size_, maps);
+  uint32_t intersect_counts(const uint32_t *lkeys, const uint32_t *lend, const uint32_t *lcounts,
+                            const uint32_t *rkeys, const uint32_t *rend, const uint32_t *rcounts) {
+    size_t lsize = lend - lkeys;
+    size_t rsize = rend - rkeys;
+    if (lsize * gallop_ratio < rsize)
+      return gallop_counts(lkeys, lend, lcounts, rkeys, rend, rcounts);
+    if (rsize * gallop_ratio < lsize)
+      return gallop_counts(rkeys, rend, rcounts, lkeys, lend, lcounts);
 
-      for (unsigned short i = 0; i < ngram_size_; ++i)
-        ++token_iterators[i];
+    uint32_t correct = 0;
+#ifdef __SSE2__
+    // Compare blocks of 4 keys with the 4 rotations of the other block, then
+    // move on from the block with the smaller last key. Keys are unique, so
+    // every match turns up in exactly one of the comparisons, and adds the
+    // smaller of its counts to the lane of its key in sums.
+    __m128i sums = _mm_setzero_si128();
+    while (lend - lkeys >= 4 && rend - rkeys >= 4) {
+      __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lkeys));
+      __m128i lc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lcounts));
+      __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rkeys));
+      __m128i rc = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rcounts));
+
+      for (int k = 0; k < 4; ++k) {
+        // Counts are far below 2^31, so a signed comparison picks the smaller
+        __m128i equal = _mm_cmpeq_epi32(l, r);
+        __m128i smaller = _mm_xor_si128(rc, _mm_and_si128(_mm_xor_si128(lc, rc), _mm_cmpgt_epi32(rc, lc)));
+        sums = _mm_add_epi32(sums, _mm_and_si128(equal, smaller));
+        r = _mm_shuffle_epi32(r, _MM_SHUFFLE(0, 3, 2, 1));
+        rc = _mm_shuffle_epi32(rc, _MM_SHUFFLE(0, 3, 2, 1));
+      }
+
+      uint32_t lmax = lkeys[3];
+      uint32_t rmax = rkeys[3];
+      if (lmax <= rmax) {
+        lkeys += 4;
+        lcounts += 4;
+      }
+      if (rmax <= lmax) {
+        rkeys += 4;
+        rcounts += 4;
+      }
     }
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+    correct = uint32_t(_mm_cvtsi128_si32(sums));
+#endif
+    return correct + intersect_counts_scalar(lkeys, lend, lcounts, rkeys, rend, rcounts);
+  }
 
-    // convert maps to sorted vectors
-    for (unsigned short i = 0; i < ngram_size_; ++i) {
-      data_[i].reserve(maps[i].size());
-      std::move(maps[i].begin(), maps[i].end(), std::back_inserter(data_[i]));
-      std::sort(data_[i].begin(), data_[i].end()); // sorts by first
+  InvertedNGramIndex::InvertedNGramIndex(const DocumentNGramIndex &index, unsigned short ngram) {
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+    for (size_t sentence = 0; sentence < index.size(); ++sentence)
+      for (const uint32_t *key = index.keys_begin(sentence, ngram); key != index.keys_end(sentence, ngram); ++key)
+        pairs.push_back(std::make_pair(*key, uint32_t(sentence)));
+    std::sort(pairs.begin(), pairs.end());
+
+    sentences_.reserve(pairs.size());
+    offsets_.push_back(0);
+    for (const std::pair<uint32_t, uint32_t> &pair : pairs) {
+      if (!keys_.empty() && keys_.back() == pair.first) {
+        ++offsets_.back();
+      } else {
+        keys_.push_back(pair.first);
+        offsets_.push_back(offsets_.back() + 1);
+      }
+      sentences_.push_back(pair.second);
     }
   }
 
+  std::pair<const uint32_t *, const uint32_t *> InvertedNGramIndex::postings(uint32_t key) const {
+    auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+    if (it == keys_.end() || *it != key)
+      return std::make_pair(sentences_.data(), sentences_.data());
+    size_t i = it - keys_.begin();
+    return std::make_pair(sentences_.data() + offsets_[i], sentences_.data() + offsets_[i + 1]);
+  }
+
   size_t NGramCounter::count_tokens() const {
     return std::accumulate(data_.begin(), data_.end(), 0, [](size_t acc, ngram_vector const &map) {
       return acc + map.size();
@@ -4,14 +4,16 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <iterator>
-#include <unordered_map>
+#include <boost/utility/string_ref.hpp>
 
 namespace ngram {
 
-    size_t get_token_hash(const std::string &token, size_t seed = 0);
+    size_t get_token_hash(boost::string_ref token, size_t seed = 0);
 
-    typedef std::unordered_map<size_t, size_t> ngram_map;
+    // Extends the key of an n-gram by a token given as its get_token_hash
+    size_t get_token_hash(uint64_t token_hash, size_t seed);
 
     typedef std::pair<size_t,size_t> ngram_pair;
 
@@ -37,6 +39,22 @@ namespace ngram {
 
         void process(std::vector<std::string> const &tokens);
 
+        // Same counts for tokens given as their get_token_hash. Unigram keys are
+        // the token hashes themselves, longer n-grams are keyed differently
+        // from the string version.
+        void process(const uint64_t *begin, const uint64_t *end);
+
+        void process(const std::vector<uint64_t> &token_hashes) {
+          process(token_hashes.data(), token_hashes.data() + token_hashes.size());
+        }
+
+        // Turns the counts of tokens A into those of A followed by the tokens
+        // counted by right, as if process() saw both. Only the n-grams across
+        // the boundary are hashed, from the last n - 1 tokens of A and the
+        // first n - 1 of right. Both counters must have been filled from token
+        // hashes with the same n.
+        void append(const NGramCounter &right);
+
         size_t count_tokens() const;
 
         size_t count_frequencies() const {
@@ -52,6 +70,87 @@ namespace ngram {
         size_t total_freq_ = 0;
         size_t tokens_processed_ = 0;
         std::vector<ngram_vector> data_;
+        // First and last n - 1 token hashes, fewer if there are fewer tokens
+        std::vector<uint64_t> head_;
+        std::vector<uint64_t> tail_;
+
+    };
+
+    // The n-gram counts of all sentences of a document in one arena. Keys are
+    // the high 32 bits of the NGramCounter keys, sorted, with their counts in
+    // a parallel array; keys that collide in those bits are counted together.
+    // The n-grams of order o of sentence s are [begin(s, o), end(s, o)).
+    class DocumentNGramIndex {
+
+    public:
+
+        explicit DocumentNGramIndex(unsigned short n);
+
+        unsigned short order() const { return ngram_size_; }
+
+        size_t size() const { return processed_.size(); }
+
+        const uint32_t *keys_begin(size_t sentence, unsigned short ngram) const {
+          return keys_.data() + offsets_[sentence * ngram_size_ + ngram - 1];
+        }
+
+        const uint32_t *keys_end(size_t sentence, unsigned short ngram) const {
+          return keys_.data() + offsets_[sentence * ngram_size_ + ngram];
+        }
+
+        // Counts of the keys from keys_begin(sentence, ngram) on
+        const uint32_t *counts_begin(size_t sentence, unsigned short ngram) const {
+          return counts_.data() + offsets_[sentence * ngram_size_ + ngram - 1];
+        }
+
+        size_t processed(size_t sentence) const { return processed_[sentence]; }
+
+        // Adds a sentence counted by counter, which must have the same n
+        void add(const NGramCounter &counter);
+
+        // Adds a sentence of tokens given as their get_token_hash
+        void add(const uint64_t *begin, const uint64_t *end);
+
+        // Removes all sentences, keeping the memory for the next document
+        void clear();
+
+    private:
+        const unsigned short ngram_size_;
+        std::vector<uint32_t> keys_;
+        std::vector<uint32_t> counts_;
+        std::vector<size_t> offsets_;
+        std::vector<uint32_t> processed_;
+        NGramCounter counter_;
+
+    };
+
+    // Sum over the keys that both sorted ranges of unique keys contain of the
+    // smaller of their counts, e.g. the matching n-grams of two sentences of
+    // a DocumentNGramIndex. Counts must be below 2^31. Compares blocks of
+    // keys with SIMD instructions where available, and gallops through the
+    // longer range when the other one is much shorter.
+    uint32_t intersect_counts(const uint32_t *lkeys, const uint32_t *lend, const uint32_t *lcounts,
+                              const uint32_t *rkeys, const uint32_t *rend, const uint32_t *rcounts);
+
+    // intersect_counts as a plain merge of the two ranges
+    uint32_t intersect_counts_scalar(const uint32_t *lkeys, const uint32_t *lend, const uint32_t *lcounts,
+                                     const uint32_t *rkeys, const uint32_t *rend, const uint32_t *rcounts);
+
+    // For every n-gram of one order of a DocumentNGramIndex, the sentences
+    // that contain it
+    class InvertedNGramIndex {
+
+    public:
+
+        InvertedNGramIndex(const DocumentNGramIndex &index, unsigned short ngram);
+
+        // The sentences containing key in ascending order, as [first, second)
+        std::pair<const uint32_t *, const uint32_t *> postings(uint32_t key) const;
+
+    private:
+        std::vector<uint32_t> keys_;
+        std::vector<size_t> offsets_;
+        std::vector<uint32_t> sentences_;
 
     };
 }
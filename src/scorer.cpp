@@ -3,49 +3,397 @@
 #include "ngram.h"
 
 #include <iostream>
-#include <boost/regex.hpp>
-#include <boost/algorithm/string.hpp>
+#include <cstring>
+#include <algorithm>
+#include <unicode/uchar.h>
+#include <unicode/uscript.h>
+#include <unicode/utf8.h>
 
 
+namespace {
+
+  enum ByteClass : unsigned char {
+    kWord,      // part of a token
+    kSymbol,    // always a token of its own, spaces are dropped
+    kDecimal,   // '.' and ',', a token unless between two digits
+    kHyphen,    // '-', a token after a digit
+  };
+
+  // Byte classes of the characters tokenize_regex splits on
+  struct ByteClassTable {
+    ByteClass classes[256];
+
+    ByteClassTable() {
+      for (int c = 0; c < 256; ++c) {
+        bool symbol = (c >= '{' && c <= '~') || (c >= '[' && c <= '`') || (c >= ' ' && c <= '&') ||
+                      (c >= '(' && c <= '+') || (c >= ':' && c <= '@') || c == '/';
+        classes[c] = symbol ? kSymbol : kWord;
+      }
+      classes[int('.')] = kDecimal;
+      classes[int(',')] = kDecimal;
+      classes[int('-')] = kHyphen;
+    }
+  };
+
+  const ByteClassTable byte_classes;
+
+  // Scripts without spaces between words. Punctuation of CJK text, above
+  // U+3000, is split off as well.
+  bool IsUnspaced(UChar32 code_point) {
+    if (code_point < 0x0E00)
+      return false;
+
+    UErrorCode error = U_ZERO_ERROR;
+    switch (uscript_getScript(code_point, &error)) {
+      case USCRIPT_HAN:
+      case USCRIPT_HIRAGANA:
+      case USCRIPT_KATAKANA:
+      case USCRIPT_BOPOMOFO:
+      case USCRIPT_THAI:
+      case USCRIPT_LAO:
+      case USCRIPT_KHMER:
+      case USCRIPT_MYANMAR:
+        return true;
+      default:
+        return code_point >= 0x3000 && u_ispunct(code_point);
+    }
+  }
+
+  // Appends the simple case folding of code_point, whose encoding is bytes
+  void AppendFolded(std::string &out, UChar32 code_point, const char *bytes, size_t size) {
+    UChar32 folded = u_foldCase(code_point, U_FOLD_CASE_DEFAULT);
+    if (folded == code_point) {
+      out.append(bytes, size);
+      return;
+    }
+
+    uint8_t encoded[U8_MAX_LENGTH];
+    int32_t length = 0;
+    U8_APPEND_UNSAFE(encoded, length, folded);
+    out.append(reinterpret_cast<const char *>(encoded), length);
+  }
+
+  inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  // Whether tokenize_regex matches the single character at position i
+  inline bool IsSeparator(const char *data, size_t size, size_t i) {
+    switch (byte_classes.classes[static_cast<unsigned char>(data[i])]) {
+      case kSymbol:
+        return true;
+      case kDecimal:
+        return !(i > 0 && IsDigit(data[i - 1]) && i + 1 < size && IsDigit(data[i + 1]));
+      case kHyphen:
+        return i > 0 && IsDigit(data[i - 1]);
+      default:
+        return false;
+    }
+  }
+
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+
+  // Whether any byte of word equals byte
+  inline bool HasByte(uint64_t word, unsigned char byte) {
+    uint64_t x = word ^ (ones * byte);
+    return ((x - ones) & ~x & highs) != 0;
+  }
+
+  // Whether all 8 bytes are ASCII that cannot start a normalizer pattern
+  inline bool IsPlainAscii(uint64_t word) {
+    return (word & highs) == 0 && !HasByte(word, '<') && !HasByte(word, '-') && !HasByte(word, '\n') &&
+           !HasByte(word, '&');
+  }
+
+  // Lowercases 8 ASCII bytes at once. Adding to a byte below 0x80 never
+  // carries into the next one, so the high bit of each byte tells whether it
+  // is at least 'A', and at least 'Z' + 1.
+  inline uint64_t LowercaseAscii(uint64_t word) {
+    uint64_t at_least_a = word + ones * (0x80 - 'A');
+    uint64_t above_z = word + ones * (0x80 - 'Z' - 1);
+    uint64_t upper = at_least_a & ~above_z & highs;
+    return word | (upper >> 2);
+  }
+
+  // Calls emit(begin, end) for the text between separators and for every
+  // separator but spaces, in order
+  template <typename Emit>
+  void ScanTokens(boost::string_ref text, const Emit &emit) {
+    const char *data = text.data();
+    const size_t size = text.size();
+    size_t last_pos = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+      if (!IsSeparator(data, size, i))
+        continue;
+
+      if (i > last_pos)
+        emit(data + last_pos, data + i);
+      if (data[i] != ' ')
+        emit(data + i, data + i + 1);
+      last_pos = i + 1;
+    }
+
+    if (last_pos < size)
+      emit(data + last_pos, data + size);
+  }
+
+}
+
 namespace scorer {
 
     void Tokenize(std::vector<std::string> &token_vec, const std::string &text) {
-      token_vec.clear();
+      // Strings left in token_vec from the previous call are reused to keep their capacity
+      size_t count = 0;
+      ScanTokens(text, [&](const char *begin, const char *end) {
+        if (count < token_vec.size())
+          token_vec[count].assign(begin, end);
+        else
+          token_vec.emplace_back(begin, end);
+        ++count;
+      });
+      token_vec.resize(count);
+    }
+
+    void Tokenize(std::vector<uint64_t> &token_hashes, boost::string_ref text) {
+      token_hashes.clear();
+      ScanTokens(text, [&](const char *begin, const char *end) {
+        token_hashes.push_back(ngram::get_token_hash(boost::string_ref(begin, end - begin)));
+      });
+    }
+
+    NormalizerProfile GetNormalizerProfile(const std::string &language_type) {
+      NormalizerProfile profile;
+      if (language_type == "western") {
+        profile.lowercase = true;
+        profile.pad = true;
+      } else if (language_type == "cjk") {
+        profile.lowercase = true;
+        profile.pad = true;
+        profile.split_characters = true;
+      }
+      return profile;
+    }
+
+    // normalize1_rules followed by normalize2_rules. No pattern contains its
+    // first character again, so a failed partial match never hides the start
+    // of another one.
+    const Normalizer::Substitution Normalizer::substitutions[Normalizer::stages] = {
+            {"<skipped>", ""},
+            {"-\n", ""},
+            {"\n", " "},
+            {"&amp;", "&"},
+            {"&lt;", "<"},
+            {"&gt;", ">"},
+            {"&quot;", "\""},
+    };
+
+    Normalizer::Normalizer(const std::string &language_type) : profile_(GetNormalizerProfile(language_type)) {
+      for (int c = 0; c < 256; ++c)
+        case_[c] = profile_.lowercase && c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
 
-      boost::sregex_iterator it(text.begin(), text.end(), tokenize_regex);
-      boost::sregex_iterator end;
-      std::stringstream ss;
-      size_t last_pos = 0;
+    void Normalizer::emit_utf8(unsigned char byte) {
+      if (!profile_.lowercase && !profile_.split_characters) {
+        buffer_.push_back(char(byte));
+        return;
+      }
+
+      if (utf8_size_ > 0) {
+        if ((byte & 0xC0) != 0x80) {
+          // Not a continuation byte, so the sequence before it was cut short
+          flush_utf8();
+          emit(char(byte));
+          return;
+        }
 
-      for (; it != end; ++it) {
-        std::string token = text.substr(last_pos, it->position() - last_pos);
+        utf8_[utf8_size_++] = byte;
+        if (utf8_size_ < utf8_expected_)
+          return;
 
-        if (token.length() > 0) {
-          token_vec.push_back(token);
+        UChar32 code_point = utf8_[0] & (0xFF >> (utf8_expected_ + 1));
+        for (size_t i = 1; i < utf8_size_; ++i)
+          code_point = (code_point << 6) | (utf8_[i] & 0x3F);
+
+        // Overlong encodings and surrogates are left alone
+        static const UChar32 min_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+        if (code_point < min_code_point[utf8_size_] || U_IS_SURROGATE(code_point) || code_point > 0x10FFFF) {
+          flush_utf8();
+          return;
         }
-        if (it->str() != " ") {
-          token_vec.push_back(it->str());
+
+        utf8_size_ = 0;
+        append_code_point(code_point, reinterpret_cast<const char *>(utf8_), utf8_expected_);
+        return;
+      }
+
+      // Lead byte of a 2, 3 or 4 byte sequence, anything else is copied
+      if (byte >= 0xC2 && byte <= 0xDF)
+        utf8_expected_ = 2;
+      else if (byte >= 0xE0 && byte <= 0xEF)
+        utf8_expected_ = 3;
+      else if (byte >= 0xF0 && byte <= 0xF4)
+        utf8_expected_ = 4;
+      else {
+        buffer_.push_back(char(byte));
+        return;
+      }
+      utf8_[0] = byte;
+      utf8_size_ = 1;
+    }
+
+    void Normalizer::append_code_point(int32_t code_point, const char *bytes, size_t size) {
+      if (profile_.split_characters) {
+        bool mark = buffer_.size() == split_end_ && u_charType(code_point) == U_NON_SPACING_MARK;
+        if (mark || IsUnspaced(code_point)) {
+          if (mark)
+            buffer_.pop_back();
+          else
+            buffer_.push_back(' ');
+          if (profile_.lowercase)
+            AppendFolded(buffer_, code_point, bytes, size);
+          else
+            buffer_.append(bytes, size);
+          buffer_.push_back(' ');
+          split_end_ = buffer_.size();
+          return;
         }
+      }
+
+      if (profile_.lowercase)
+        AppendFolded(buffer_, code_point, bytes, size);
+      else
+        buffer_.append(bytes, size);
+    }
+
+    void Normalizer::flush_utf8() {
+      buffer_.append(reinterpret_cast<const char *>(utf8_), utf8_size_);
+      utf8_size_ = 0;
+    }
+
+    void Normalizer::feed(size_t stage, char c) {
+      if (stage == stages) {
+        emit(c);
+        return;
+      }
+
+      const Substitution &substitution = substitutions[stage];
+      size_t &matched = matched_[stage];
+
+      if (c == substitution.pattern[matched]) {
+        if (matched++ == 0)
+          ++pending_;
+        if (matched < substitution.pattern.size())
+          return;
 
-        last_pos = it->position() + it->str().length();
+        matched = 0;
+        --pending_;
+        for (char r : substitution.replacement)
+          feed(stage + 1, r);
+        return;
       }
 
-      if (last_pos < text.length()) {
-        token_vec.push_back(text.substr(last_pos, text.length() - last_pos));
+      if (matched > 0) {
+        // Release the held back bytes, none of which starts a new match, then
+        // look at c again from the start of the pattern
+        size_t held = matched;
+        matched = 0;
+        --pending_;
+        for (size_t i = 0; i < held; ++i)
+          feed(stage + 1, substitution.pattern[i]);
+        feed(stage, c);
+        return;
       }
 
+      feed(stage + 1, c);
     }
 
-    void normalize(std::vector<std::string> &token_vec, const std::string &text, const std::string &language_type) {
-      std::string normalized_text = scorer::ApplyNormalizeRules(text, scorer::normalize1_rules);
-      normalized_text = scorer::ApplyNormalizeRules(normalized_text, scorer::normalize2_rules);
+    const std::string &Normalizer::operator()(boost::string_ref text) {
+      buffer_.clear();
+      buffer_.reserve(text.size() + 2);
+      split_end_ = std::string::npos;
+      if (profile_.pad)
+        buffer_.push_back(' ');
 
-      if (language_type == "western") {
-        boost::algorithm::to_lower(normalized_text);
-        normalized_text.insert(0, " ");
-        normalized_text.push_back(' ');
+      const char *pos = text.data();
+      const char *end = pos + text.size();
+      while (pos != end) {
+        // Nothing held back by the stages or emit, so plain ASCII goes straight
+        // to the buffer a word at a time
+        if (pending_ == 0 && utf8_size_ == 0) {
+          uint64_t word;
+          while (end - pos >= 8 && (std::memcpy(&word, pos, 8), IsPlainAscii(word))) {
+            if (profile_.lowercase)
+              word = LowercaseAscii(word);
+            buffer_.append(reinterpret_cast<const char *>(&word), 8);
+            pos += 8;
+          }
+          if (pos == end)
+            break;
+        }
+
+        // Nothing can interrupt a UTF-8 sequence that starts here, so it is
+        // decoded in place. Invalid bytes are copied unchanged.
+        if (pending_ == 0 && utf8_size_ == 0 && static_cast<unsigned char>(*pos) >= 0x80) {
+          int32_t size = 0;
+          int32_t length = int32_t(std::min<ptrdiff_t>(end - pos, U8_MAX_LENGTH));
+          UChar32 code_point;
+          U8_NEXT(pos, size, length, code_point);
+          if (code_point < 0 || (!profile_.lowercase && !profile_.split_characters))
+            buffer_.append(pos, size);
+          else
+            append_code_point(code_point, pos, size);
+          pos += size;
+          continue;
+        }
+
+        // Most bytes cannot start a match and pass through every stage unchanged
+        char c = *pos++;
+        if (pending_ == 0 && c != '<' && c != '-' && c != '\n' && c != '&')
+          emit(c);
+        else
+          feed(0, c);
       }
 
-      scorer::Tokenize(token_vec, normalized_text);
+      // Release partial matches at the end of the text, earliest stage first
+      for (size_t stage = 0; stage < stages; ++stage) {
+        size_t held = matched_[stage];
+        if (held == 0)
+          continue;
+        matched_[stage] = 0;
+        --pending_;
+        for (size_t i = 0; i < held; ++i)
+          feed(stage + 1, substitutions[stage].pattern[i]);
+      }
+
+      flush_utf8();
+
+      if (profile_.pad)
+        buffer_.push_back(' ');
+      return buffer_;
+    }
+
+    void normalize(std::vector<std::string> &token_vec, boost::string_ref text, const std::string &language_type) {
+      Normalizer normalizer(language_type);
+      normalize(token_vec, text, normalizer);
+    }
+
+    void normalize(std::vector<std::string> &token_vec, boost::string_ref text, Normalizer &normalizer) {
+      scorer::Tokenize(token_vec, normalizer(text));
+    }
+
+    void normalize(std::vector<uint64_t> &token_hashes, boost::string_ref text, Normalizer &normalizer) {
+      scorer::Tokenize(token_hashes, normalizer(text));
+    }
+
+    void normalize(utils::TokenBlock &tokens, const utils::SentenceBlock &text, const std::string &language_type) {
+      Normalizer normalizer(language_type);
+      std::vector<uint64_t> hashes;
+
+      for (boost::string_ref sentence : text) {
+        normalize(hashes, sentence, normalizer);
+        tokens.push_back(hashes.data(), hashes.data() + hashes.size());
+      }
     }
 }
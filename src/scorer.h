@@ -3,16 +3,21 @@
 #define FAST_BLEUALIGN_SCORER_H
 
 #include "ngram.h"
+#include "utils/common.h"
 
 #include <string>
 #include <regex>
 #include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 
 namespace scorer {
 
     typedef std::pair<std::regex, std::string> rule_pair;
 
+    // Separators Tokenize splits on. Every match is a single character, which
+    // Tokenize finds with a byte class table instead; the regex is the reference
+    // it is tested against.
     const static boost::regex tokenize_regex(
             R"(([\{-\~\[-\` -\&\(-\+\:-\@\/])|(?:(?<![0-9])([\.,]))|(?:([\.,])(?![0-9]))|(?:(?<=[0-9])(-)))");
 
@@ -38,9 +43,97 @@ namespace scorer {
       return s;
     }
 
+    // What normalize does for a language type besides applying the rules,
+    // looked up once instead of comparing the name for every sentence
+    struct NormalizerProfile {
+        // Unicode simple case folding of UTF-8 text, which lowercases
+        bool lowercase = false;
+        // Surround the text with spaces
+        bool pad = false;
+        // Make every character of scripts written without spaces, like Chinese,
+        // Japanese and Thai, a token of its own. Combining marks stay with the
+        // character before them.
+        bool split_characters = false;
+    };
+
+    // "western", or "cjk" for western text mixed with scripts that have no
+    // spaces between words. Any other language type only applies the rules.
+    NormalizerProfile GetNormalizerProfile(const std::string &language_type);
+
+    // Applies normalize1_rules, normalize2_rules and the profile in a single
+    // scan. Each rule is a small state machine fed by the one before it, so the
+    // result is the same as running the passes one after another. Runs of ASCII
+    // without pattern bytes are copied and lowercased 8 bytes at a time.
+    class Normalizer {
+
+    public:
+
+        explicit Normalizer(const std::string &language_type);
+
+        // The normalized text, valid until the next call
+        const std::string &operator()(boost::string_ref text);
+
+    private:
+
+        struct Substitution {
+            boost::string_ref pattern;
+            boost::string_ref replacement;
+        };
+
+        static const size_t stages = 7;
+        static const Substitution substitutions[stages];
+
+        void feed(size_t stage, char c);
+
+        // Appends a byte that made it through the stages, lowercasing ASCII
+        // right away and UTF-8 sequences once they are complete
+        void emit(char c) {
+          unsigned char byte = static_cast<unsigned char>(c);
+          if (byte < 0x80 && utf8_size_ == 0)
+            buffer_.push_back(char(case_[byte]));
+          else
+            emit_utf8(byte);
+        }
+
+        void emit_utf8(unsigned char byte);
+
+        // Appends a decoded code point whose encoding is bytes, as the profile asks
+        void append_code_point(int32_t code_point, const char *bytes, size_t size);
+
+        // Appends the bytes of an incomplete or invalid sequence unchanged
+        void flush_utf8();
+
+        NormalizerProfile profile_;
+        unsigned char case_[256];
+        // Bytes of a partial match held back by each stage
+        size_t matched_[stages] = {};
+        size_t pending_ = 0;
+        // UTF-8 sequence being collected by emit
+        unsigned char utf8_[4];
+        size_t utf8_size_ = 0;
+        size_t utf8_expected_ = 0;
+        // Size of buffer_ after the space that ended the last split character
+        size_t split_end_ = std::string::npos;
+        std::string buffer_;
+
+    };
+
+    // Splits text into the text between separators and the separators
+    // themselves, except spaces
     void Tokenize(std::vector<std::string> &token_vec, const std::string &text);
 
-    void normalize(std::vector<std::string> &token_vec, const std::string &text, const std::string &language_type);
+    // Same tokens as their ngram::get_token_hash, without building strings
+    void Tokenize(std::vector<uint64_t> &token_hashes, boost::string_ref text);
+
+    void normalize(std::vector<std::string> &token_vec, boost::string_ref text, const std::string &language_type);
+
+    void normalize(std::vector<std::string> &token_vec, boost::string_ref text, Normalizer &normalizer);
+
+    // Normalizes and tokenizes text straight into token hashes for NGramCounter
+    void normalize(std::vector<uint64_t> &token_hashes, boost::string_ref text, Normalizer &normalizer);
+
+    // Normalizes every sentence of text and appends its tokens, as get_token_hash, to tokens
+    void normalize(utils::TokenBlock &tokens, const utils::SentenceBlock &text, const std::string &language_type);
 
 }
 
@@ -8,7 +8,6 @@
 #include <utility>
 
 #include <boost/make_unique.hpp>
-#include <boost/functional/hash.hpp>
 
 
 namespace search {
@@ -41,22 +40,30 @@ namespace search {
       return back_pointers[r * cols + c];
     }
 
-    void Dynamic::process(std::vector<utils::scoremap> &smap_list) {
-      if(smap_list.size() != rows - 1) {
+    void Dynamic::process(const utils::CandidateTable &scorelist) {
+      if(scorelist.rows() != rows - 1) {
         throw std::runtime_error("Dimensions in Dynamic::process do not match!");
       }
 
-      for (size_t s = 0; s < smap_list.size(); ++s) {
-        // iterate in reverse order so the entry with the lowest 
-        for (auto it = smap_list[s].rbegin(), end = smap_list[s].rend(); it != end; ++it) {
-          alignments.insert({{s, it->second.first}, it->first});
-        }
-      }
+      alignments = &scorelist;
+
+      // the candidates of a row are spread over its columns while it is filled
+      std::vector<float> row_scores(cols - 1);
+      std::vector<char> row_aligned(cols - 1, 0);
 
       float score, best_score;
       char pointer;
 
       for (size_t r = 0; r < rows - 1; ++r) {
+        // iterate in reverse order so the best of repeated columns is kept
+        for (const utils::CandidateTable::Candidate *it = alignments->end(r); it != alignments->begin(r);) {
+          --it;
+          if (it->index < cols - 1) {
+            row_scores[it->index] = it->score;
+            row_aligned[it->index] = 1;
+          }
+        }
+
         for (size_t c = 0; c < cols - 1; ++c) {
           best_score = get_score(r, c + 1);
           pointer = '^';
@@ -67,9 +74,8 @@ namespace search {
             pointer = '<';
           }
 
-          boost::unordered_map<utils::sizet_pair, float>::const_iterator got = alignments.find({r, c});
-          if (got != alignments.end()) {
-            score = got->second + get_score(r, c);
+          if (row_aligned[c]) {
+            score = row_scores[c] + get_score(r, c);
 
             if (score > best_score) {
               best_score = score;
@@ -81,6 +87,11 @@ namespace search {
           get_backpointer(r, c) = pointer;
 
         }
+
+        for (const utils::CandidateTable::Candidate *it = alignments->begin(r); it != alignments->end(r); ++it) {
+          if (it->index < cols - 1)
+            row_aligned[it->index] = 0;
+        }
       }
     }
 
@@ -109,12 +120,13 @@ namespace search {
           j -= 1;
         } else if (pointer == 'm') {
 
-          float score;
-          boost::unordered_map<utils::sizet_pair, float>::const_iterator got = alignments.find({i, j});
-          if (got != alignments.end())
-            score = got->second;
-          else
-            score = 0;
+          float score = 0;
+          for (const utils::CandidateTable::Candidate *it = alignments->begin(i); it != alignments->end(i); ++it) {
+            if (it->index == size_t(j)) {
+              score = it->score;
+              break;
+            }
+          }
 
           res.push_back(utils::match(i, i, j, j, score));
           i -= 1;
@@ -161,22 +173,19 @@ namespace search {
 
     }
 
-    void Munkres::process(std::vector<utils::scoremap> &smap_list) {
+    void Munkres::process(const utils::CandidateTable &scorelist) {
       double val;
-      for (size_t i = 0; i < smap_list.size(); ++i) {
-        auto it = smap_list.at(i).rbegin();
-        while (it != smap_list.at(i).rend()) {
+      for (size_t i = 0; i < scorelist.rows(); ++i) {
+        for (const utils::CandidateTable::Candidate *it = scorelist.begin(i); it != scorelist.end(i); ++it) {
           if (min_cost)
-            val = it->first;
+            val = it->score;
           else
-            val = search::max_score - it->first;
+            val = search::max_score - it->score;
 
           if (transposed) {
-            *get_cost(it->second.first, i) = val;
-            ++it;
+            *get_cost(it->index, i) = val;
           } else {
-            *get_cost(i, it->second.first) = val;
-            ++it;
+            *get_cost(i, it->index) = val;
           }
         }
       }
@@ -498,7 +507,7 @@ namespace search {
       }
     }
 
-    void FindMatches(utils::matches_vec &matches, std::vector<utils::scoremap> &scorelist,
+    void FindMatches(utils::matches_vec &matches, const utils::CandidateTable &scorelist,
                      size_t translated_size, size_t english_size, float threshold) {
       Dynamic finder(translated_size, english_size);
       finder.process(scorelist);
@@ -506,7 +515,7 @@ namespace search {
       FilterMatches(matches, scorelist, threshold);
     }
 
-    void FilterMatches(utils::matches_vec &matches, std::vector<utils::scoremap> &scorelist, float threshold) {
+    void FilterMatches(utils::matches_vec &matches, const utils::CandidateTable &scorelist, float threshold) {
       for (auto m: matches) {
         if (!m.first.same() || !m.second.same())
           throw std::runtime_error("Inconsistent data: Only 1:1 alignments can be filtered!");
@@ -515,16 +524,16 @@ namespace search {
       utils::matches_vec matches_cpy;
       std::swap(matches, matches_cpy);
 
-      utils::scoremap::reverse_iterator it;
       for (auto m: matches_cpy) {
-        it = scorelist.at(m.first.from).rbegin();
-        while (it != scorelist.at(m.first.from).rend()) {
-          if (it->second.first == m.second.from && it->first > threshold) {
+        if (m.first.from >= scorelist.rows())
+          throw std::out_of_range("FilterMatches: match beyond the scored sentences");
+
+        for (const utils::CandidateTable::Candidate *it = scorelist.begin(m.first.from);
+             it != scorelist.end(m.first.from); ++it) {
+          if (it->index == m.second.from && it->score > threshold) {
             matches.push_back(m);
             break;
           }
-
-          ++it;
         }
       }
     }
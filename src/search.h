@@ -11,7 +11,6 @@
 #include <vector>
 #include <stdexcept>
 #include <memory>
-#include <boost/unordered_map.hpp>
 
 
 namespace search {
@@ -22,7 +21,7 @@ namespace search {
 
     public:
 
-        virtual void process(std::vector<utils::scoremap> &smap_list) = 0;
+        virtual void process(const utils::CandidateTable &scorelist) = 0;
 
         virtual void extract_matches(utils::matches_vec &res) = 0;
 
@@ -40,7 +39,7 @@ namespace search {
 
         char &get_backpointer(size_t r, size_t c);
 
-        void process(std::vector<utils::scoremap> &smap_list) override;
+        void process(const utils::CandidateTable &scorelist) override;
 
         void show();
 
@@ -52,7 +51,9 @@ namespace search {
         size_t rows = 0;
         size_t cols = 0;
 
-        boost::unordered_map<utils::sizet_pair, float> alignments;
+        // the candidates the matches are picked from, for their scores; the
+        // table given to process has to outlive extract_matches
+        const utils::CandidateTable *alignments = nullptr;
         std::unique_ptr<float[]> scores;
         std::unique_ptr<char[]> back_pointers;
 
@@ -67,7 +68,7 @@ namespace search {
 
         ~Munkres() = default;;
 
-        void process(std::vector<utils::scoremap> &smap_list);
+        void process(const utils::CandidateTable &scorelist);
 
         void process(const std::vector<double> &input_costs);
 
@@ -125,10 +126,10 @@ namespace search {
     };
 
 
-    void FindMatches(utils::matches_vec &matches, std::vector<utils::scoremap> &scorelist, size_t translated_size,
+    void FindMatches(utils::matches_vec &matches, const utils::CandidateTable &scorelist, size_t translated_size,
                      size_t english_size, float threshold = 0);
 
-    void FilterMatches(utils::matches_vec &matches, std::vector<utils::scoremap> &scorelist, float threshold = 0);
+    void FilterMatches(utils::matches_vec &matches, const utils::CandidateTable &scorelist, float threshold = 0);
 
 
 }
@@ -0,0 +1,198 @@
+#include "base64.h"
+
+#include <string>
+#include <sstream>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEUALIGN_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+  const signed char decode_table[256] = {
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+          52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+          -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+          15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+          -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+          41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  };
+
+  void ThrowInvalid(const char *data, size_t pos) {
+    std::stringstream error;
+    error << "Invalid base64 character 0x" << std::hex << int(static_cast<unsigned char>(data[pos]))
+          << std::dec << " at offset " << pos;
+    throw utils::Base64Error(error.str(), pos);
+  }
+
+  // Decodes [pos, size) four characters at a time. A trailing incomplete group
+  // yields as many whole bytes as its bits allow.
+  size_t DecodeScalar(unsigned char *out, const char *data, size_t pos, size_t size) {
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+    unsigned char *o = out;
+
+    for (; pos + 4 <= size; pos += 4) {
+      int a = decode_table[in[pos]], b = decode_table[in[pos + 1]];
+      int c = decode_table[in[pos + 2]], d = decode_table[in[pos + 3]];
+      if ((a | b | c | d) < 0) {
+        for (size_t i = pos; ; ++i)
+          if (decode_table[in[i]] < 0) ThrowInvalid(data, i);
+      }
+      uint32_t v = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | uint32_t(d);
+      *o++ = static_cast<unsigned char>(v >> 16);
+      *o++ = static_cast<unsigned char>(v >> 8);
+      *o++ = static_cast<unsigned char>(v);
+    }
+
+    uint32_t v = 0;
+    size_t rest = size - pos;
+    for (size_t i = pos; i < size; ++i) {
+      int c = decode_table[in[i]];
+      if (c < 0) ThrowInvalid(data, i);
+      v = (v << 6) | uint32_t(c);
+    }
+    if (rest == 2) {
+      *o++ = static_cast<unsigned char>(v >> 4);
+    } else if (rest == 3) {
+      *o++ = static_cast<unsigned char>(v >> 10);
+      *o++ = static_cast<unsigned char>(v >> 2);
+    }
+
+    return o - out;
+  }
+
+#ifdef BLEUALIGN_BASE64_X86
+
+  // Vectorized decoding after Wojciech Muła's nibble lookup: two pshufb lookups
+  // classify every byte, a third one gives the offset that maps the character
+  // to its 6-bit value, and multiply-adds pack four 6-bit values into 3 bytes.
+  // The loops stop at the first block holding a non-alphabet character and
+  // return how much input they consumed, so the scalar code reports the error.
+
+  __attribute__((target("sse4.1")))
+  size_t DecodeSSE(unsigned char *&out, const char *data, size_t size) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t pos = 0;
+    for (; pos + 16 <= size; pos += 16) {
+      __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+      const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+      const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+      const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+      const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+      if (!_mm_testz_si128(lo, hi))
+        break;
+
+      const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+      str = _mm_add_epi8(str, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+
+      const __m128i merged = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+      const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(packed, pack));
+      out += 12;
+    }
+    return pos;
+  }
+
+  __attribute__((target("avx2")))
+  size_t DecodeAVX2(unsigned char *&out, const char *data, size_t size) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+    size_t pos = 0;
+    for (; pos + 32 <= size; pos += 32) {
+      __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+      const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+      const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+      const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+      const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+      if (!_mm256_testz_si256(lo, hi))
+        break;
+
+      const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+      str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+
+      const __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+      __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+      packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, pack), lanes);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), packed);
+      out += 24;
+    }
+    return pos;
+  }
+
+  enum class Isa { scalar, sse, avx2 };
+
+  Isa DetectIsa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return Isa::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+      return Isa::sse;
+    return Isa::scalar;
+  }
+
+  const Isa isa = DetectIsa();
+
+#endif
+}
+
+namespace utils {
+
+    void DecodeBase64(std::string &out, const char *data, size_t size) {
+      // Strip padding, the vector loops only see alphabet characters
+      size_t padding = 0;
+      while (padding < 2 && size > padding && data[size - padding - 1] == '=')
+        ++padding;
+      size -= padding;
+
+      // Vector stores write a few bytes past the decoded data
+      out.resize(size / 4 * 3 + 3 + 32);
+      unsigned char *begin = reinterpret_cast<unsigned char *>(&out[0]);
+      unsigned char *o = begin;
+      size_t pos = 0;
+
+#ifdef BLEUALIGN_BASE64_X86
+      if (isa == Isa::avx2) {
+        pos = DecodeAVX2(o, data, size);
+      }
+      if (isa != Isa::scalar) {
+        pos += DecodeSSE(o, data + pos, size - pos);
+      }
+#endif
+
+      o += DecodeScalar(o, data, pos, size);
+      out.resize(o - begin);
+    }
+
+} // namespace utils
@@ -0,0 +1,36 @@
+
+#ifndef FAST_BLEUALIGN_BASE64_H
+#define FAST_BLEUALIGN_BASE64_H
+
+#include <string>
+#include <stdexcept>
+
+namespace utils {
+
+    // Raised on characters outside the base64 alphabet. Offset is the position
+    // of the offending character in the encoded input.
+    class Base64Error : public std::runtime_error {
+
+    public:
+
+        Base64Error(const std::string &what, size_t offset) : std::runtime_error(what), offset_(offset) {};
+
+        size_t offset() const { return offset_; }
+
+    private:
+        size_t offset_;
+
+    };
+
+    // Decodes base64 text into out, reusing its capacity. Up to two trailing '='
+    // are accepted as padding and an incomplete final group is decoded as far as
+    // it goes. Uses AVX2 or SSE4.1 when the CPU supports them.
+    void DecodeBase64(std::string &out, const char *data, size_t size);
+
+    inline void DecodeBase64(std::string &out, const std::string &str) {
+      DecodeBase64(out, str.data(), str.size());
+    }
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_BASE64_H
@@ -0,0 +1,177 @@
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+  [[noreturn]] void ThrowErrno(const std::string &what, const std::string &path) {
+    throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+  }
+
+  // Parses value as a number, naming key and path if it is not one
+  uint64_t ParseNumber(const std::string &value, const std::string &key, const std::string &path) {
+    try {
+      size_t pos;
+      uint64_t number = std::stoull(value, &pos);
+      if (pos == value.size())
+        return number;
+    } catch (const std::logic_error &) {
+    }
+    throw std::runtime_error("Invalid " + key + " in checkpoint " + path);
+  }
+
+}
+
+namespace utils {
+
+    void WriteCheckpoint(const std::string &path, const Checkpoint &checkpoint) {
+      if (checkpoint.filename.find('\n') != std::string::npos)
+        throw std::runtime_error("Cannot checkpoint input file names containing a newline");
+
+      std::stringstream text;
+      text << "file\t" << checkpoint.file << "\n"
+           << "filename\t" << checkpoint.filename << "\n"
+           << "line\t" << checkpoint.line << "\n"
+           << "input_offset\t" << checkpoint.input_offset << "\n"
+           << "columns\t" << checkpoint.columns << "\n"
+           << "output_offset\t" << checkpoint.output_offset << "\n";
+      std::string data = text.str();
+
+      // Write a temporary file and rename it over the checkpoint
+      std::string tmp = path + ".tmp";
+      int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (fd == -1)
+        ThrowErrno("Could not create", tmp);
+
+      const char *pos = data.data();
+      size_t left = data.size();
+      while (left > 0) {
+        ssize_t written = write(fd, pos, left);
+        if (written == -1) {
+          if (errno == EINTR)
+            continue;
+          close(fd);
+          ThrowErrno("Could not write", tmp);
+        }
+        pos += written;
+        left -= written;
+      }
+
+      if (fsync(fd) == -1) {
+        close(fd);
+        ThrowErrno("Could not sync", tmp);
+      }
+      close(fd);
+
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        ThrowErrno("Could not replace", path);
+    }
+
+    bool ReadCheckpoint(const std::string &path, Checkpoint &checkpoint) {
+      std::ifstream in(path);
+      if (!in) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1 && errno == ENOENT)
+          return false;
+        throw std::runtime_error("Could not open checkpoint " + path);
+      }
+
+      Checkpoint read;
+      bool seen[6] = {};
+      std::string line;
+      while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+          throw std::runtime_error("Invalid line in checkpoint " + path + ": " + line);
+        std::string key = line.substr(0, tab);
+        std::string value = line.substr(tab + 1);
+
+        if (key == "file") {
+          read.file = ParseNumber(value, key, path);
+          seen[0] = true;
+        } else if (key == "filename") {
+          read.filename = value;
+          seen[1] = true;
+        } else if (key == "line") {
+          read.line = ParseNumber(value, key, path);
+          seen[2] = true;
+        } else if (key == "input_offset") {
+          read.input_offset = ParseNumber(value, key, path);
+          seen[3] = true;
+        } else if (key == "columns") {
+          read.columns = ParseNumber(value, key, path);
+          seen[4] = true;
+        } else if (key == "output_offset") {
+          read.output_offset = ParseNumber(value, key, path);
+          seen[5] = true;
+        } else {
+          throw std::runtime_error("Unknown field " + key + " in checkpoint " + path);
+        }
+      }
+
+      for (bool field : seen)
+        if (!field)
+          throw std::runtime_error("Checkpoint " + path + " is incomplete");
+
+      checkpoint = read;
+      return true;
+    }
+
+    Checkpointer::Checkpointer(const std::string &path, double interval, OutputWriter &writer, int output_fd) :
+            path_(path),
+            interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(interval))),
+            writer_(writer),
+            output_fd_(output_fd),
+            last_save_(std::chrono::steady_clock::now()) {
+    }
+
+    void Checkpointer::start_file(size_t file, const std::string &filename) {
+      checkpoint_.file = file;
+      checkpoint_.filename = filename;
+    }
+
+    void Checkpointer::document_done(size_t line, uint64_t input_offset, size_t columns) {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - last_save_ < interval_)
+        return;
+
+      checkpoint_.line = line;
+      checkpoint_.input_offset = input_offset;
+      checkpoint_.columns = columns;
+      writer_.sync();
+      save();
+      last_save_ = now;
+    }
+
+    void Checkpointer::complete(size_t files) {
+      // Keeps the name of the last file, so a resume can tell the run apart
+      checkpoint_.file = files;
+      checkpoint_.line = 0;
+      checkpoint_.input_offset = 0;
+      checkpoint_.columns = 0;
+      save();
+    }
+
+    void Checkpointer::save() {
+      // The output must be on disk before a checkpoint points past it
+      if (fdatasync(output_fd_) == -1)
+        ThrowErrno("Could not sync the output for checkpoint", path_);
+
+      off_t output_offset = lseek(output_fd_, 0, SEEK_CUR);
+      if (output_offset == off_t(-1))
+        ThrowErrno("Could not get the output offset for checkpoint", path_);
+      checkpoint_.output_offset = uint64_t(output_offset);
+
+      WriteCheckpoint(path_, checkpoint_);
+    }
+
+} // namespace utils
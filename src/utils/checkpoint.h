@@ -0,0 +1,65 @@
+
+#ifndef FAST_BLEUALIGN_CHECKPOINT_H
+#define FAST_BLEUALIGN_CHECKPOINT_H
+
+#include "output_writer.h"
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+namespace utils {
+
+    // How far a run got: the input records up to input_offset of input file
+    // number file were aligned, and their output ends at output_offset. Once
+    // the run is complete, file is the number of input files and filename the
+    // last of them.
+    struct Checkpoint {
+        size_t file = 0;
+        std::string filename;
+        size_t line = 0;
+        uint64_t input_offset = 0;
+        size_t columns = 0;
+        uint64_t output_offset = 0;
+    };
+
+    // Replaces the checkpoint at path, so that a crash leaves either the old
+    // or the new one behind
+    void WriteCheckpoint(const std::string &path, const Checkpoint &checkpoint);
+
+    // False if there is no checkpoint at path. Throws if it is unreadable.
+    bool ReadCheckpoint(const std::string &path, Checkpoint &checkpoint);
+
+    // Saves a checkpoint every interval seconds of an alignment run whose
+    // output goes through writer to output_fd, a regular file
+    class Checkpointer {
+
+    public:
+
+        Checkpointer(const std::string &path, double interval, OutputWriter &writer, int output_fd);
+
+        void start_file(size_t file, const std::string &filename);
+
+        // Called after the output of record line, which ends at input_offset,
+        // was handed to the writer. columns is the field count of the first line.
+        void document_done(size_t line, uint64_t input_offset, size_t columns);
+
+        // Called after the writer finished the output of all files
+        void complete(size_t files);
+
+    private:
+
+        void save();
+
+        std::string path_;
+        std::chrono::steady_clock::duration interval_;
+        OutputWriter &writer_;
+        int output_fd_;
+        std::chrono::steady_clock::time_point last_save_;
+        Checkpoint checkpoint_;
+
+    };
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_CHECKPOINT_H
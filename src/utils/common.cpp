@@ -1,8 +1,12 @@
 
 #include "common.h"
+#include "base64.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
+#include <stdexcept>
+#include <cstring>
 
 #include <boost/algorithm/string.hpp>
 
@@ -21,11 +25,169 @@ namespace utils {
         vec.emplace_back(std::string(last_it, it));
     }
 
-    void DecodeAndSplit(std::vector<std::string> &vec, const std::string &str, char delimiter, bool trim){
-        std::string decoded = std::string(binary_text(str.begin()), binary_text(str.end()));
+    void SplitString(std::vector<boost::string_ref> &vec, boost::string_ref str, char delimiter, bool trim){
+      vec.clear();
+      if (str.empty()) return;
+      const char *end = str.data() + str.size();
+      const char *last = str.data();
+      const char *it;
+      while ((it = static_cast<const char *>(std::memchr(last, delimiter, end - last))) != nullptr) {
+        vec.emplace_back(last, it - last);
+        last = it + 1;
+      }
+      if (!trim || last != end)
+        vec.emplace_back(last, end - last);
+    }
+
+    SentenceBlock::SentenceBlock(const std::vector<std::string> &sentences) : offsets_(1, 0) {
+      for (const std::string &sentence : sentences)
+        push_back(sentence);
+    }
+
+    boost::string_ref SentenceBlock::at(size_t i) const {
+      if (i >= size())
+        throw std::out_of_range("SentenceBlock::at");
+
+      return (*this)[i];
+    }
+
+    void SentenceBlock::clear() {
+      buffer_.clear();
+      offsets_.assign(1, 0);
+    }
+
+    void SentenceBlock::push_back(boost::string_ref sentence) {
+      buffer_.append(sentence.data(), sentence.size());
+      buffer_.push_back('\n');
+      offsets_.push_back(buffer_.size());
+    }
+
+    void SentenceBlock::split(char delimiter, bool trim) {
+      offsets_.assign(1, 0);
+      if (buffer_.empty()) return;
+
+      const char *begin = buffer_.data();
+      const char *end = begin + buffer_.size();
+      const char *last = begin;
+      const char *it;
+      while ((it = static_cast<const char *>(std::memchr(last, delimiter, end - last))) != nullptr) {
+        offsets_.push_back(it - begin + 1);
+        last = it + 1;
+      }
+      // The last sentence has no delimiter after it, act as if it had one
+      if (!trim || last != end)
+        offsets_.push_back(buffer_.size() + 1);
+    }
+
+    void TokenBlock::clear() {
+      tokens_.clear();
+      offsets_.assign(1, 0);
+    }
+
+    void TokenBlock::push_back(const uint64_t *begin, const uint64_t *end) {
+      tokens_.insert(tokens_.end(), begin, end);
+      offsets_.push_back(tokens_.size());
+    }
+
+    uint64_t *TokenBlock::append_sentence(size_t count) {
+      tokens_.resize(tokens_.size() + count);
+      offsets_.push_back(tokens_.size());
+      return tokens_.data() + tokens_.size() - count;
+    }
+
+    void CandidateTable::reset(size_t capacity, unsigned short order) {
+      capacity_ = capacity;
+      order_ = order;
+      candidates_.clear();
+      correct_.clear();
+      sizes_.clear();
+    }
+
+    void CandidateTable::add_row() {
+      candidates_.resize(candidates_.size() + capacity_);
+      correct_.resize(correct_.size() + capacity_ * order_);
+      sizes_.push_back(0);
+    }
+
+    namespace {
+      // Whether candidate a ranks below candidate b
+      inline bool Worse(const CandidateTable::Candidate &a, const CandidateTable::Candidate &b) {
+        return a.score < b.score || (a.score == b.score && a.index < b.index);
+      }
+    }
+
+    void CandidateTable::swap(size_t row, size_t a, size_t b) {
+      Candidate *candidates = candidates_.data() + row * capacity_;
+      int *row_correct = correct_.data() + row * capacity_ * order_;
+      std::swap(candidates[a], candidates[b]);
+      std::swap_ranges(row_correct + a * order_, row_correct + (a + 1) * order_, row_correct + b * order_);
+    }
+
+    void CandidateTable::sift_down(size_t row, size_t pos, size_t size) {
+      const Candidate *candidates = candidates_.data() + row * capacity_;
+      while (2 * pos + 1 < size) {
+        size_t child = 2 * pos + 1;
+        if (child + 1 < size && Worse(candidates[child + 1], candidates[child]))
+          ++child;
+        if (!Worse(candidates[child], candidates[pos]))
+          break;
+        swap(row, pos, child);
+        pos = child;
+      }
+    }
+
+    void CandidateTable::insert(size_t row, float score, size_t index, const int *correct) {
+      Candidate *candidates = candidates_.data() + row * capacity_;
+      int *row_correct = correct_.data() + row * capacity_ * order_;
+      Candidate candidate = {score, index};
+      size_t size = sizes_[row];
+
+      if (size < capacity_) {
+        // append and sift up
+        size_t pos = sizes_[row]++;
+        candidates[pos] = candidate;
+        std::copy(correct, correct + order_, row_correct + pos * order_);
+        while (pos > 0 && Worse(candidates[pos], candidates[(pos - 1) / 2])) {
+          swap(row, pos, (pos - 1) / 2);
+          pos = (pos - 1) / 2;
+        }
+      } else if (capacity_ > 0 && Worse(candidates[0], candidate)) {
+        // replace the worst candidate
+        candidates[0] = candidate;
+        std::copy(correct, correct + order_, row_correct);
+        sift_down(row, 0, size);
+      }
+    }
+
+    void CandidateTable::sort(size_t row) {
+      // moving the worst candidate out of the heap to its end leaves the best first
+      for (size_t size = sizes_[row]; size > 1; --size) {
+        swap(row, 0, size - 1);
+        sift_down(row, 0, size - 1);
+      }
+    }
+
+    void SplitString(SentenceBlock &block, const std::string &str, char delimiter, bool trim) {
+      block.buffer().assign(str);
+      block.split(delimiter, trim);
+    }
+
+    void DecodeAndSplit(std::vector<std::string> &vec, boost::string_ref str, char delimiter, bool trim){
+        // Decoding buffer is kept per thread so its capacity is reused across lines
+        static thread_local std::string decoded;
+        DecodeBase64(decoded, str.data(), str.size());
         boost::trim_right_if(decoded, [](char c) {
             return c == '\0';
         });
         SplitString(vec, decoded, delimiter, trim);
     }
+
+    void DecodeAndSplit(SentenceBlock &block, boost::string_ref str, char delimiter, bool trim){
+        std::string &decoded = block.buffer();
+        DecodeBase64(decoded, str.data(), str.size());
+        boost::trim_right_if(decoded, [](char c) {
+            return c == '\0';
+        });
+        block.split(delimiter, trim);
+    }
 } // namespace utils
@@ -10,8 +10,10 @@
 #include <map>
 #include <set>
 
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
+#include <string>
+#include <iterator>
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
 
 namespace utils {
 
@@ -51,34 +53,200 @@ namespace utils {
     typedef std::pair<size_t, size_t> sizet_pair;
     typedef std::vector<sizet_pair> vec_pair;
 
-    // Scoremap stores a list of alignments scores for 1 vs N sentences. Key is
-    // the score, values are the 
-    typedef std::multimap<float, std::pair<size_t, std::vector<int>>> scoremap;
     typedef std::vector<match> matches_vec;
 
+    // The best scoring sentences of text2 for every sentence of text1. Each
+    // row keeps at most capacity candidates in a fixed slice of one array,
+    // with the numbers of matching n-grams that scored them in another. While
+    // a row is filled it is a heap with its worst candidate first, and sort()
+    // orders it best first once it is complete. Of candidates with equal
+    // scores the one of the later sentence ranks first.
+    class CandidateTable {
+
+    public:
+
+        struct Candidate {
+            float score;
+            size_t index;
+        };
+
+        explicit CandidateTable(size_t capacity = 0, unsigned short order = 0) : capacity_(capacity), order_(order) {};
+
+        // Removes all rows, new ones keep capacity candidates with the matching
+        // n-grams of order 1 to order
+        void reset(size_t capacity, unsigned short order);
+
+        size_t rows() const { return sizes_.size(); }
+
+        size_t capacity() const { return capacity_; }
+
+        unsigned short order() const { return order_; }
+
+        void add_row();
+
+        size_t size(size_t row) const { return sizes_[row]; }
+
+        bool empty(size_t row) const { return sizes_[row] == 0; }
+
+        bool full(size_t row) const { return sizes_[row] == capacity_; }
+
+        const Candidate *begin(size_t row) const { return candidates_.data() + row * capacity_; }
+
+        const Candidate *end(size_t row) const { return begin(row) + sizes_[row]; }
+
+        // The score of the worst candidate of a row that is being filled and
+        // is not empty
+        float worst(size_t row) const { return begin(row)->score; }
+
+        // The matching n-grams of every order of candidate k of row
+        const int *correct(size_t row, size_t k) const {
+          return correct_.data() + (row * capacity_ + k) * order_;
+        }
+
+        // Adds a candidate to row unless it is full of better ones, dropping
+        // the worst one if it was full. correct holds order() numbers of
+        // matching n-grams and may be null if that is 0.
+        void insert(size_t row, float score, size_t index, const int *correct = nullptr);
+
+        // Orders a row best first, after which nothing is inserted in it
+        void sort(size_t row);
+
+    private:
+        void swap(size_t row, size_t a, size_t b);
+
+        void sift_down(size_t row, size_t pos, size_t size);
+
+        size_t capacity_;
+        unsigned short order_;
+        std::vector<Candidate> candidates_;
+        std::vector<int> correct_;
+        std::vector<size_t> sizes_;
+
+    };
+
+
+    // Sentences of a document column stored back to back in a single buffer.
+    // Sentence i spans [offsets_[i], offsets_[i + 1] - 1), leaving out the
+    // delimiter that followed it, and is handed out as a string_ref.
+    class SentenceBlock {
+
+    public:
+
+        class const_iterator : public std::iterator<std::forward_iterator_tag, boost::string_ref> {
+
+        public:
+
+            const_iterator(const SentenceBlock *block, size_t pos) : block_(block), pos_(pos) {};
+
+            boost::string_ref operator*() const { return (*block_)[pos_]; }
+
+            const_iterator &operator++() { ++pos_; return *this; }
+
+            bool operator==(const const_iterator &rhs) const { return pos_ == rhs.pos_; }
+
+            bool operator!=(const const_iterator &rhs) const { return pos_ != rhs.pos_; }
+
+        private:
+            const SentenceBlock *block_;
+            size_t pos_;
+
+        };
+
+        SentenceBlock() : offsets_(1, 0) {};
+
+        SentenceBlock(const std::vector<std::string> &sentences);
+
+        size_t size() const { return offsets_.size() - 1; }
+
+        bool empty() const { return offsets_.size() == 1; }
+
+        boost::string_ref operator[](size_t i) const {
+          return boost::string_ref(buffer_.data() + offsets_[i], offsets_[i + 1] - offsets_[i] - 1);
+        }
+
+        boost::string_ref at(size_t i) const;
+
+        const_iterator begin() const { return const_iterator(this, 0); }
+
+        const_iterator end() const { return const_iterator(this, size()); }
+
+        void clear();
+
+        void push_back(boost::string_ref sentence);
+
+        // Raw storage, filled in place by DecodeAndSplit and SplitString before split()
+        std::string &buffer() { return buffer_; }
+
+        // Rebuild the sentence offsets by splitting the buffer at delimiter, with
+        // the same rules as SplitString
+        void split(char delimiter, bool trim = false);
+
+    private:
+        std::string buffer_;
+        std::vector<size_t> offsets_;
+
+    };
+
+    // Token hashes of the sentences of a document column, produced by the
+    // normalizer ahead of time. Tokens of sentence i are
+    // [offsets_[i], offsets_[i + 1]) in tokens_.
+    class TokenBlock {
+
+    public:
+
+        TokenBlock() : offsets_(1, 0) {};
+
+        size_t size() const { return offsets_.size() - 1; }
+
+        bool empty() const { return offsets_.size() == 1; }
+
+        const uint64_t *sentence_begin(size_t i) const { return tokens_.data() + offsets_[i]; }
+
+        const uint64_t *sentence_end(size_t i) const { return tokens_.data() + offsets_[i + 1]; }
+
+        size_t sentence_size(size_t i) const { return offsets_[i + 1] - offsets_[i]; }
+
+        void clear();
+
+        void push_back(const uint64_t *begin, const uint64_t *end);
+
+        // Adds a sentence of count tokens and returns where to write them
+        uint64_t *append_sentence(size_t count);
+
+    private:
+        std::vector<uint64_t> tokens_;
+        std::vector<size_t> offsets_;
+
+    };
 
     struct DocumentPair {
         std::string url1;
         std::string url2;
-        std::vector<std::string> text1;
-        std::vector<std::string> text2;
-        std::vector<std::string> text1translated;
-        std::vector<std::string> text2translated;
+        SentenceBlock text1;
+        SentenceBlock text2;
+        SentenceBlock text1translated;
+        SentenceBlock text2translated;
+        // Without a trg_translated column text2 is scored directly instead of
+        // being copied into text2translated
+        bool text2translated_provided = false;
         std::vector<std::vector<std::string>> text1metadata;
         std::vector<std::vector<std::string>> text2metadata;
+        // Pre-tokenized input scores text1tokens against text2tokens instead of
+        // normalizing text1translated and translated_text2()
+        bool pretokenized = false;
+        TokenBlock text1tokens;
+        TokenBlock text2tokens;
+
+        const SentenceBlock &translated_text2() const {
+          return text2translated_provided ? text2translated : text2;
+        }
     };
 
-    typedef boost::archive::iterators::transform_width<
-        boost::archive::iterators::binary_from_base64<
-            std::string::const_iterator
-        >,
-        8,
-        6
-    >
-    binary_text;
-
     void SplitString(std::vector<std::string> &vec, const std::string &str, char delimiter, bool trim = false);
-    void DecodeAndSplit(std::vector<std::string> &vec, const std::string &str, char delimiter, bool trim = false);
+    void SplitString(std::vector<boost::string_ref> &vec, boost::string_ref str, char delimiter, bool trim = false);
+    void SplitString(SentenceBlock &block, const std::string &str, char delimiter, bool trim = false);
+    void DecodeAndSplit(std::vector<std::string> &vec, boost::string_ref str, char delimiter, bool trim = false);
+    void DecodeAndSplit(SentenceBlock &block, boost::string_ref str, char delimiter, bool trim = false);
 } // namespace utils
 
 
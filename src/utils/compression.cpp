@@ -0,0 +1,559 @@
+#include "compression.h"
+
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/make_unique.hpp>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_XZLIB
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+  const size_t input_buffer_size = 1 << 20;
+
+#if !defined(HAVE_ZLIB) || !defined(HAVE_XZLIB) || !defined(HAVE_ZSTD)
+  [[noreturn]] void ThrowUnsupported(const std::string &format) {
+    throw std::runtime_error("Support for " + format + " compression was not compiled in");
+  }
+#endif
+
+#ifdef HAVE_ZLIB
+
+  class GzipSource : public utils::ByteSource {
+
+  public:
+
+    explicit GzipSource(std::unique_ptr<utils::ByteSource> source) :
+            source_(std::move(source)), in_(boost::make_unique<char[]>(input_buffer_size)) {
+      std::memset(&stream_, 0, sizeof(stream_));
+      // 15 + 32: maximum window, detect the gzip or zlib header
+      if (inflateInit2(&stream_, 15 + 32) != Z_OK)
+        throw std::runtime_error("Could not initialize gzip decoder");
+    }
+
+    ~GzipSource() override {
+      inflateEnd(&stream_);
+    }
+
+    size_t read(char *to, size_t amount) override {
+      stream_.next_out = reinterpret_cast<Bytef *>(to);
+      stream_.avail_out = amount;
+
+      while (stream_.avail_out == amount) {
+        if (stream_.avail_in == 0 && !eof_) {
+          stream_.next_in = reinterpret_cast<Bytef *>(in_.get());
+          stream_.avail_in = source_->read(in_.get(), input_buffer_size);
+          eof_ = stream_.avail_in == 0;
+        }
+        if (stream_.avail_in == 0) {
+          if (in_member_)
+            throw std::runtime_error("Truncated gzip input");
+          break;
+        }
+
+        in_member_ = true;
+        int ret = inflate(&stream_, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+          // Concatenated gzip members, as written by the gzip output
+          inflateReset(&stream_);
+          in_member_ = false;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+          throw std::runtime_error(std::string("Invalid gzip input: ") + (stream_.msg ? stream_.msg : "unknown error"));
+        }
+      }
+
+      return amount - stream_.avail_out;
+    }
+
+  private:
+    std::unique_ptr<utils::ByteSource> source_;
+    std::unique_ptr<char[]> in_;
+    z_stream stream_;
+    bool eof_ = false;
+    bool in_member_ = false;
+
+  };
+
+  void CompressGzipMember(const std::string &input, std::string &output) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 15 + 16: maximum window, gzip header
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error("Could not initialize gzip encoder");
+
+    output.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = input.size();
+    stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+    stream.avail_out = output.size();
+
+    int ret = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+      throw std::runtime_error("gzip compression failed");
+  }
+
+  // Compresses blocks of output into independent gzip members on a pool of
+  // threads, and writes them out in order.
+  class GzipSink : public utils::ByteSink {
+
+  public:
+
+    GzipSink(std::unique_ptr<utils::ByteSink> sink, size_t threads, size_t block_size = 1 << 22) :
+            sink_(std::move(sink)), threads_(threads), block_size_(block_size) {
+      if (threads_ > 1)
+        for (size_t i = 0; i < threads_; ++i)
+          pool_.emplace_back(&GzipSink::worker, this);
+    }
+
+    ~GzipSink() override {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      work_available_.notify_all();
+      for (std::thread &t : pool_)
+        t.join();
+    }
+
+    void write(const char *data, size_t size) override {
+      pending_.append(data, size);
+      if (pending_.size() >= block_size_)
+        submit();
+    }
+
+    // Writes out the blocks compressed so far without waiting for the others,
+    // and keeps the partial block until it is full, so that interval flushes
+    // neither make small members nor stall the compression
+    void flush() override {
+      drain(std::numeric_limits<size_t>::max());
+      sink_->flush();
+    }
+
+    // Every block is a member of its own already
+    void sync() override {
+      if (!pending_.empty())
+        submit();
+      drain(0);
+      sink_->sync();
+    }
+
+    void finish() override {
+      // An empty file is not valid gzip, write an empty member instead
+      if (!written_ || !pending_.empty())
+        submit();
+      drain(0);
+      sink_->finish();
+    }
+
+  private:
+
+    struct Block {
+      std::string input;
+      std::string output;
+      std::exception_ptr error;
+      bool done = false;
+    };
+
+    void submit() {
+      std::shared_ptr<Block> block = std::make_shared<Block>();
+      block->input.swap(pending_);
+      written_ = true;
+
+      if (threads_ <= 1) {
+        CompressGzipMember(block->input, block->output);
+        sink_->write(block->output.data(), block->output.size());
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        in_flight_.push_back(block);
+        queue_.push_back(block);
+      }
+      work_available_.notify_one();
+
+      // Bound memory use by waiting for the oldest blocks
+      drain(2 * threads_);
+    }
+
+    // Writes finished blocks in order until at most max_in_flight remain
+    void drain(size_t max_in_flight) {
+      while (true) {
+        std::shared_ptr<Block> block;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          if (in_flight_.empty())
+            return;
+          if (in_flight_.size() <= max_in_flight && !in_flight_.front()->done)
+            return;
+          block_done_.wait(lock, [&] { return in_flight_.front()->done; });
+          block = in_flight_.front();
+          in_flight_.pop_front();
+        }
+
+        if (block->error)
+          std::rethrow_exception(block->error);
+        sink_->write(block->output.data(), block->output.size());
+      }
+    }
+
+    void worker() {
+      while (true) {
+        std::shared_ptr<Block> block;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          work_available_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+          if (stop_)
+            return;
+          block = queue_.front();
+          queue_.pop_front();
+        }
+
+        try {
+          CompressGzipMember(block->input, block->output);
+        } catch (...) {
+          block->error = std::current_exception();
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          std::string().swap(block->input);
+          block->done = true;
+        }
+        block_done_.notify_all();
+      }
+    }
+
+    std::unique_ptr<utils::ByteSink> sink_;
+    size_t threads_;
+    size_t block_size_;
+    std::string pending_;
+    bool written_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable block_done_;
+    std::deque<std::shared_ptr<Block>> in_flight_;
+    std::deque<std::shared_ptr<Block>> queue_;
+    bool stop_ = false;
+    std::vector<std::thread> pool_;
+
+  };
+
+#endif
+
+#ifdef HAVE_XZLIB
+
+  class XzSource : public utils::ByteSource {
+
+  public:
+
+    explicit XzSource(std::unique_ptr<utils::ByteSource> source) :
+            source_(std::move(source)), in_(boost::make_unique<char[]>(input_buffer_size)) {
+      if (lzma_stream_decoder(&stream_, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+        throw std::runtime_error("Could not initialize xz decoder");
+    }
+
+    ~XzSource() override {
+      lzma_end(&stream_);
+    }
+
+    size_t read(char *to, size_t amount) override {
+      stream_.next_out = reinterpret_cast<uint8_t *>(to);
+      stream_.avail_out = amount;
+
+      while (stream_.avail_out == amount && !done_) {
+        if (stream_.avail_in == 0 && !eof_) {
+          stream_.next_in = reinterpret_cast<uint8_t *>(in_.get());
+          stream_.avail_in = source_->read(in_.get(), input_buffer_size);
+          eof_ = stream_.avail_in == 0;
+        }
+
+        lzma_ret ret = lzma_code(&stream_, eof_ ? LZMA_FINISH : LZMA_RUN);
+        if (ret == LZMA_STREAM_END) {
+          done_ = true;
+        } else if (ret != LZMA_OK) {
+          std::stringstream error;
+          error << "Invalid xz input (lzma error " << ret << ")";
+          throw std::runtime_error(error.str());
+        }
+      }
+
+      return amount - stream_.avail_out;
+    }
+
+  private:
+    std::unique_ptr<utils::ByteSource> source_;
+    std::unique_ptr<char[]> in_;
+    lzma_stream stream_ = LZMA_STREAM_INIT;
+    bool eof_ = false;
+    bool done_ = false;
+
+  };
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+  class ZstdSource : public utils::ByteSource {
+
+  public:
+
+    explicit ZstdSource(std::unique_ptr<utils::ByteSource> source) :
+            source_(std::move(source)), in_(boost::make_unique<char[]>(input_buffer_size)),
+            stream_(ZSTD_createDStream()) {
+      if (!stream_)
+        throw std::runtime_error("Could not initialize zstd decoder");
+      input_ = {in_.get(), 0, 0};
+    }
+
+    ~ZstdSource() override {
+      ZSTD_freeDStream(stream_);
+    }
+
+    size_t read(char *to, size_t amount) override {
+      ZSTD_outBuffer output = {to, amount, 0};
+
+      while (output.pos == 0) {
+        if (input_.pos == input_.size && !eof_) {
+          input_.size = source_->read(in_.get(), input_buffer_size);
+          input_.pos = 0;
+          eof_ = input_.size == 0;
+        }
+
+        // Also called without input at the end, to drain what the decoder holds
+        size_t consumed = input_.pos;
+        size_t ret = ZSTD_decompressStream(stream_, &output, &input_);
+        if (ZSTD_isError(ret))
+          throw std::runtime_error(std::string("Invalid zstd input: ") + ZSTD_getErrorName(ret));
+
+        // 0 means a frame was completed, the next one starts with new input
+        if (ret == 0)
+          in_frame_ = false;
+        else if (input_.pos != consumed)
+          in_frame_ = true;
+
+        if (eof_ && output.pos == 0) {
+          if (in_frame_)
+            throw std::runtime_error("Truncated zstd input");
+          break;
+        }
+      }
+
+      return output.pos;
+    }
+
+  private:
+    std::unique_ptr<utils::ByteSource> source_;
+    std::unique_ptr<char[]> in_;
+    ZSTD_DStream *stream_;
+    ZSTD_inBuffer input_;
+    bool eof_ = false;
+    bool in_frame_ = false;
+
+  };
+
+  class ZstdSink : public utils::ByteSink {
+
+  public:
+
+    ZstdSink(std::unique_ptr<utils::ByteSink> sink, size_t threads) :
+            sink_(std::move(sink)), context_(ZSTD_createCCtx()), out_(ZSTD_CStreamOutSize(), '\0') {
+      if (!context_)
+        throw std::runtime_error("Could not initialize zstd encoder");
+      ZSTD_CCtx_setParameter(context_, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+      // Fails on a libzstd built without thread support, which then compresses on this thread
+      if (threads > 1)
+        ZSTD_CCtx_setParameter(context_, ZSTD_c_nbWorkers, int(threads));
+    }
+
+    ~ZstdSink() override {
+      ZSTD_freeCCtx(context_);
+    }
+
+    void write(const char *data, size_t size) override {
+      ZSTD_inBuffer input = {data, size, 0};
+      while (input.pos < input.size)
+        compress(input, ZSTD_e_continue);
+    }
+
+    // Forcing out a partial block would wait for the workers, so interval
+    // flushes only pass on what the encoder has written already
+    void flush() override {
+      sink_->flush();
+    }
+
+    void sync() override {
+      // The next write starts a new frame
+      ZSTD_inBuffer input = {nullptr, 0, 0};
+      while (compress(input, ZSTD_e_end) != 0);
+      sink_->sync();
+    }
+
+    void finish() override {
+      ZSTD_inBuffer input = {nullptr, 0, 0};
+      while (compress(input, ZSTD_e_end) != 0);
+      sink_->finish();
+    }
+
+  private:
+
+    size_t compress(ZSTD_inBuffer &input, ZSTD_EndDirective mode) {
+      ZSTD_outBuffer output = {&out_[0], out_.size(), 0};
+      size_t remaining = ZSTD_compressStream2(context_, &output, &input, mode);
+      if (ZSTD_isError(remaining))
+        throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+      sink_->write(out_.data(), output.pos);
+      return remaining;
+    }
+
+    std::unique_ptr<utils::ByteSink> sink_;
+    ZSTD_CCtx *context_;
+    std::string out_;
+
+  };
+
+#endif
+
+}
+
+namespace utils {
+
+    FdSource::FdSource(int fd, const std::string &name, bool owns_fd) : fd_(fd), name_(name), owns_fd_(owns_fd) {
+      posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    FdSource::~FdSource() {
+      if (owns_fd_)
+        close(fd_);
+    }
+
+    size_t FdSource::read(char *to, size_t amount) {
+      while (true) {
+        ssize_t got = ::read(fd_, to, amount);
+        if (got >= 0)
+          return got;
+        if (errno != EINTR)
+          throw std::runtime_error("Could not read " + name_ + ": " + std::strerror(errno));
+      }
+    }
+
+    bool FdSource::seek(uint64_t offset) {
+      // Past the end lseek would succeed, leave that to reading
+      struct stat st;
+      if (fstat(fd_, &st) == -1 || !S_ISREG(st.st_mode) || offset > uint64_t(st.st_size))
+        return false;
+      return lseek(fd_, off_t(offset), SEEK_SET) != off_t(-1);
+    }
+
+    void FdSink::write(const char *data, size_t size) {
+      while (size > 0) {
+        ssize_t written = ::write(fd_, data, size);
+        if (written < 0) {
+          if (errno == EINTR)
+            continue;
+          throw std::runtime_error(std::string("Could not write output: ") + std::strerror(errno));
+        }
+        data += written;
+        size -= written;
+      }
+    }
+
+    Compression DetectCompression(const char *data, size_t size) {
+      const unsigned char *magic = reinterpret_cast<const unsigned char *>(data);
+
+      if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return Compression::gzip;
+      if (size >= 6 && std::memcmp(magic, "\xfd" "7zXZ\x00", 6) == 0)
+        return Compression::xz;
+      if (size >= 4 && std::memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0)
+        return Compression::zstd;
+
+      return Compression::none;
+    }
+
+    Compression ParseCompression(const std::string &name) {
+      if (name.empty() || name == "none")
+        return Compression::none;
+      if (name == "gzip")
+        return Compression::gzip;
+      if (name == "zstd")
+        return Compression::zstd;
+
+      throw std::runtime_error("Unknown output compression " + name + ", expected none, gzip or zstd");
+    }
+
+    std::unique_ptr<ByteSource> MakeDecompressor(Compression type, std::unique_ptr<ByteSource> source) {
+      switch (type) {
+        case Compression::none:
+          return source;
+        case Compression::gzip:
+#ifdef HAVE_ZLIB
+          return boost::make_unique<GzipSource>(std::move(source));
+#else
+          ThrowUnsupported("gzip");
+#endif
+        case Compression::xz:
+#ifdef HAVE_XZLIB
+          return boost::make_unique<XzSource>(std::move(source));
+#else
+          ThrowUnsupported("xz");
+#endif
+        case Compression::zstd:
+#ifdef HAVE_ZSTD
+          return boost::make_unique<ZstdSource>(std::move(source));
+#else
+          ThrowUnsupported("zstd");
+#endif
+      }
+
+      throw std::runtime_error("Unknown compression");
+    }
+
+    std::unique_ptr<ByteSink> MakeCompressor(Compression type, std::unique_ptr<ByteSink> sink, size_t threads) {
+      switch (type) {
+        case Compression::none:
+          return sink;
+        case Compression::gzip:
+#ifdef HAVE_ZLIB
+          return boost::make_unique<GzipSink>(std::move(sink), threads);
+#else
+          ThrowUnsupported("gzip");
+#endif
+        case Compression::zstd:
+#ifdef HAVE_ZSTD
+          return boost::make_unique<ZstdSink>(std::move(sink), threads);
+#else
+          ThrowUnsupported("zstd");
+#endif
+        case Compression::xz:
+          throw std::runtime_error("xz output compression is not supported");
+      }
+
+      throw std::runtime_error("Unknown compression");
+    }
+
+} // namespace utils
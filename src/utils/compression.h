@@ -0,0 +1,103 @@
+
+#ifndef FAST_BLEUALIGN_COMPRESSION_H
+#define FAST_BLEUALIGN_COMPRESSION_H
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+namespace utils {
+
+    // Raw bytes coming from a file descriptor, a mapping or a decoder
+    class ByteSource {
+
+    public:
+
+        virtual ~ByteSource() = default;
+
+        // Reads up to amount bytes into to, returns 0 at the end of the input
+        virtual size_t read(char *to, size_t amount) = 0;
+
+        // Continues reading at byte offset of the input, if the source can
+        virtual bool seek(uint64_t) { return false; }
+
+    };
+
+    // Destination of the output bytes, possibly through an encoder
+    class ByteSink {
+
+    public:
+
+        virtual ~ByteSink() = default;
+
+        virtual void write(const char *data, size_t size) = 0;
+
+        // Push what was written so far out to the underlying file. Encoders
+        // may keep a partial block back, which only sync() and finish() force out.
+        virtual void flush() = 0;
+
+        // Like flush(), but also ends the compressed member or frame, so that
+        // the file cut at this point is complete and can be appended to
+        virtual void sync() { flush(); }
+
+        // Flush and terminate the stream, nothing may be written afterwards
+        virtual void finish() = 0;
+
+    };
+
+    class FdSource : public ByteSource {
+
+    public:
+
+        FdSource(int fd, const std::string &name, bool owns_fd = false);
+
+        ~FdSource() override;
+
+        size_t read(char *to, size_t amount) override;
+
+        bool seek(uint64_t offset) override;
+
+    private:
+        int fd_;
+        std::string name_;
+        bool owns_fd_;
+
+    };
+
+    class FdSink : public ByteSink {
+
+    public:
+
+        explicit FdSink(int fd) : fd_(fd) {};
+
+        void write(const char *data, size_t size) override;
+
+        void flush() override {};
+
+        void finish() override {};
+
+    private:
+        int fd_;
+
+    };
+
+    enum class Compression { none, gzip, xz, zstd };
+
+    // Recognizes gzip, xz and zstd streams by their magic bytes
+    Compression DetectCompression(const char *data, size_t size);
+
+    // Parses an --output-compression value: none, gzip or zstd
+    Compression ParseCompression(const std::string &name);
+
+    // Wraps source with a decoder for the given format. Throws when support for
+    // it was not compiled in.
+    std::unique_ptr<ByteSource> MakeDecompressor(Compression type, std::unique_ptr<ByteSource> source);
+
+    // Wraps sink with an encoder for the given format, compressing with up to
+    // threads threads. gzip output is written as concatenated members, one per
+    // block, so the blocks can be compressed independently.
+    std::unique_ptr<ByteSink> MakeCompressor(Compression type, std::unique_ptr<ByteSink> sink, size_t threads = 1);
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_COMPRESSION_H
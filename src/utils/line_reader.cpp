@@ -0,0 +1,238 @@
+#include "line_reader.h"
+
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/make_unique.hpp>
+
+namespace {
+
+  void ThrowSystemError(const std::string &what, const std::string &name) {
+    std::stringstream error;
+    error << what << " " << name << ": " << std::strerror(errno);
+    throw std::runtime_error(error.str());
+  }
+
+  // Longest magic number DetectCompression looks at
+  const size_t magic_size = 6;
+
+  // Hands out bytes read ahead to detect the compression before the rest
+  class PrefixedSource : public utils::ByteSource {
+
+  public:
+
+    PrefixedSource(std::string prefix, std::unique_ptr<utils::ByteSource> source) :
+            prefix_(std::move(prefix)), source_(std::move(source)) {};
+
+    size_t read(char *to, size_t amount) override {
+      if (pos_ < prefix_.size()) {
+        size_t n = std::min(amount, prefix_.size() - pos_);
+        std::memcpy(to, prefix_.data() + pos_, n);
+        pos_ += n;
+        return n;
+      }
+      return source_->read(to, amount);
+    }
+
+    // The prefix holds the first bytes of source, so seeking source skips it too
+    bool seek(uint64_t offset) override {
+      if (!source_->seek(offset))
+        return false;
+      pos_ = prefix_.size();
+      return true;
+    }
+
+  private:
+    std::string prefix_;
+    size_t pos_ = 0;
+    std::unique_ptr<utils::ByteSource> source_;
+
+  };
+
+  std::unique_ptr<utils::ByteSource> Decompress(std::unique_ptr<utils::ByteSource> source) {
+    std::string prefix(magic_size, '\0');
+    size_t got = 0, n;
+    while (got < magic_size && (n = source->read(&prefix[got], magic_size - got)) > 0)
+      got += n;
+    prefix.resize(got);
+
+    utils::Compression compression = utils::DetectCompression(prefix.data(), prefix.size());
+    std::unique_ptr<utils::ByteSource> prefixed = boost::make_unique<PrefixedSource>(prefix, std::move(source));
+    return utils::MakeDecompressor(compression, std::move(prefixed));
+  }
+
+  int OpenFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+      ThrowSystemError("Could not open", filename);
+    return fd;
+  }
+
+}
+
+namespace utils {
+
+    MappedFileReader::MappedFileReader(int fd, size_t size, const std::string &name) : size_(size) {
+      if (size_ == 0)
+        return;
+
+      void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+        ThrowSystemError("Could not map", name);
+
+      madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(data);
+    }
+
+    MappedFileReader::~MappedFileReader() {
+      if (data_)
+        munmap(const_cast<char *>(data_), size_);
+    }
+
+    bool MappedFileReader::read_line(boost::string_ref &line) {
+      if (pos_ >= size_)
+        return false;
+
+      const char *begin = data_ + pos_;
+      const char *newline = static_cast<const char *>(std::memchr(begin, '\n', size_ - pos_));
+      size_t length = newline ? size_t(newline - begin) : size_ - pos_;
+
+      line = boost::string_ref(begin, length);
+      pos_ = std::min(pos_ + length + 1, size_);
+      return true;
+    }
+
+    void MappedFileReader::skip_to(uint64_t offset) {
+      if (offset > size_)
+        throw std::runtime_error("Input is shorter than the checkpoint offset");
+      pos_ = offset;
+    }
+
+    StreamLineReader::StreamLineReader(std::unique_ptr<ByteSource> source, size_t block_size) :
+            source_(std::move(source)), buffer_(boost::make_unique<char[]>(block_size)), capacity_(block_size) {
+    }
+
+    FdLineReader::FdLineReader(int fd, const std::string &name, bool owns_fd, size_t block_size) :
+            StreamLineReader(boost::make_unique<FdSource>(fd, name, owns_fd), block_size) {
+    }
+
+    bool StreamLineReader::fill() {
+      // Move the unfinished line to the front, or grow the buffer if it already fills it
+      if (begin_ > 0) {
+        std::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+        base_ += begin_;
+        end_ -= begin_;
+        scanned_ -= begin_;
+        begin_ = 0;
+      } else if (end_ == capacity_) {
+        std::unique_ptr<char[]> grown = boost::make_unique<char[]>(capacity_ * 2);
+        std::memcpy(grown.get(), buffer_.get(), end_);
+        buffer_.swap(grown);
+        capacity_ *= 2;
+      }
+
+      size_t got = source_->read(buffer_.get() + end_, capacity_ - end_);
+      if (got == 0) {
+        eof_ = true;
+        return false;
+      }
+      end_ += got;
+      return true;
+    }
+
+    bool StreamLineReader::read_line(boost::string_ref &line) {
+      while (true) {
+        const char *newline = static_cast<const char *>(
+                std::memchr(buffer_.get() + scanned_, '\n', end_ - scanned_));
+        if (newline) {
+          size_t pos = newline - buffer_.get();
+          line = boost::string_ref(buffer_.get() + begin_, pos - begin_);
+          begin_ = scanned_ = pos + 1;
+          return true;
+        }
+        scanned_ = end_;
+
+        if (eof_ || !fill()) {
+          // Last line without a trailing newline
+          if (begin_ == end_)
+            return false;
+          line = boost::string_ref(buffer_.get() + begin_, end_ - begin_);
+          begin_ = scanned_ = end_;
+          return true;
+        }
+      }
+    }
+
+    void StreamLineReader::skip_to(uint64_t offset) {
+      if (offset >= base_ && offset <= base_ + end_) {
+        begin_ = scanned_ = offset - base_;
+        return;
+      }
+
+      // The source is positioned right after the buffered bytes
+      base_ += end_;
+      begin_ = end_ = scanned_ = 0;
+      if (source_->seek(offset)) {
+        base_ = offset;
+        eof_ = false;
+        return;
+      }
+
+      // Not seekable, e.g. a pipe or a decoder, so read up to offset
+      if (offset < base_)
+        throw std::runtime_error("Cannot go back in a stream that is not seekable");
+      while (base_ + end_ < offset) {
+        base_ += end_;
+        end_ = 0;
+        if (eof_ || !fill())
+          throw std::runtime_error("Input is shorter than the checkpoint offset");
+      }
+      begin_ = scanned_ = offset - base_;
+    }
+
+    std::unique_ptr<LineReader> OpenLineReader(const std::string &filename) {
+      if (filename == "-")
+        return boost::make_unique<StreamLineReader>(OpenByteSource(filename));
+
+      int fd = OpenFile(filename);
+
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        char magic[magic_size];
+        ssize_t got = pread(fd, magic, sizeof(magic), 0);
+        Compression compression = DetectCompression(magic, got > 0 ? got : 0);
+
+        if (compression != Compression::none)
+          return boost::make_unique<StreamLineReader>(
+                  MakeDecompressor(compression, boost::make_unique<FdSource>(fd, filename, true)));
+
+        std::unique_ptr<LineReader> reader;
+        try {
+          reader = boost::make_unique<MappedFileReader>(fd, st.st_size, filename);
+        } catch (...) {
+          close(fd);
+          throw;
+        }
+        // The mapping stays valid after closing the descriptor
+        close(fd);
+        return reader;
+      }
+
+      return boost::make_unique<StreamLineReader>(Decompress(boost::make_unique<FdSource>(fd, filename, true)));
+    }
+
+    std::unique_ptr<ByteSource> OpenByteSource(const std::string &filename) {
+      if (filename == "-")
+        return Decompress(boost::make_unique<FdSource>(STDIN_FILENO, "stdin"));
+
+      return Decompress(boost::make_unique<FdSource>(OpenFile(filename), filename, true));
+    }
+
+} // namespace utils
@@ -0,0 +1,113 @@
+
+#ifndef FAST_BLEUALIGN_LINE_READER_H
+#define FAST_BLEUALIGN_LINE_READER_H
+
+#include "compression.h"
+
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
+
+namespace utils {
+
+    // Hands out input lines in place, without copying them into a std::string.
+    class LineReader {
+
+    public:
+
+        virtual ~LineReader() = default;
+
+        // Points line at the next line, without its trailing '\n'. Returns false
+        // at the end of the input. Unless lines_persist(), the line is only valid
+        // until the next call.
+        virtual bool read_line(boost::string_ref &line) = 0;
+
+        virtual bool lines_persist() const = 0;
+
+        // Byte offset in the (decompressed) input right after the last line read
+        virtual uint64_t offset() const = 0;
+
+        // Continues reading at offset, a value offset() returned earlier for the
+        // same input. Seeks when it can, otherwise reads up to it. Throws if the
+        // input is shorter.
+        virtual void skip_to(uint64_t offset) = 0;
+
+    };
+
+    // Maps a whole regular file into memory and scans it sequentially.
+    class MappedFileReader : public LineReader {
+
+    public:
+
+        MappedFileReader(int fd, size_t size, const std::string &name);
+
+        ~MappedFileReader() override;
+
+        bool read_line(boost::string_ref &line) override;
+
+        bool lines_persist() const override { return true; }
+
+        uint64_t offset() const override { return pos_; }
+
+        void skip_to(uint64_t offset) override;
+
+    private:
+
+        const char *data_ = nullptr;
+        size_t size_ = 0;
+        size_t pos_ = 0;
+
+    };
+
+    // Reads a byte source (stdin, pipes, decoders) in large blocks. Lines are
+    // returned from the block buffer, which grows to hold the longest line seen.
+    class StreamLineReader : public LineReader {
+
+    public:
+
+        explicit StreamLineReader(std::unique_ptr<ByteSource> source, size_t block_size = 1 << 22);
+
+        bool read_line(boost::string_ref &line) override;
+
+        bool lines_persist() const override { return false; }
+
+        uint64_t offset() const override { return base_ + begin_; }
+
+        void skip_to(uint64_t offset) override;
+
+    private:
+
+        bool fill();
+
+        std::unique_ptr<ByteSource> source_;
+        uint64_t base_ = 0; // offset of buffer_[0] in the input
+        std::unique_ptr<char[]> buffer_;
+        size_t capacity_;
+        size_t begin_ = 0;
+        size_t end_ = 0;
+        size_t scanned_ = 0;
+        bool eof_ = false;
+
+    };
+
+    class FdLineReader : public StreamLineReader {
+
+    public:
+
+        explicit FdLineReader(int fd, const std::string &name, bool owns_fd = false, size_t block_size = 1 << 22);
+
+    };
+
+    // Memory maps regular files and falls back on StreamLineReader for anything
+    // else (named pipes, process substitution). "-" reads stdin. gzip, xz and
+    // zstd input is recognized by its magic bytes and decoded on the fly.
+    std::unique_ptr<LineReader> OpenLineReader(const std::string &filename);
+
+    // Opens filename, or stdin for "-", as a stream of bytes, decoding gzip, xz
+    // and zstd like OpenLineReader
+    std::unique_ptr<ByteSource> OpenByteSource(const std::string &filename);
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_LINE_READER_H
@@ -0,0 +1,121 @@
+#include "output_writer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+  void AppendDecimal(std::string &out, uint64_t value) {
+    char buf[20];
+    int i = sizeof(buf);
+    do {
+      buf[--i] = char('0' + value % 10);
+      value /= 10;
+    } while (value);
+    out.append(buf + i, sizeof(buf) - i);
+  }
+
+}
+
+namespace utils {
+
+    void AppendFixed6(std::string &out, double value) {
+      // Scores are computed as floats, and a float times 1e6 is exact in a
+      // double, so rounding the product half to even gives the same digits
+      // as printf. Anything else goes through snprintf. The checks look at the
+      // bits because -Ofast assumes there are no NaNs or negative zeros: a
+      // non-negative double below 1e9 compares like its bit pattern, and float
+      // precision leaves the low 29 mantissa bits clear.
+      uint64_t bits, limit_bits;
+      const double limit = 1e9;
+      std::memcpy(&bits, &value, sizeof(bits));
+      std::memcpy(&limit_bits, &limit, sizeof(limit_bits));
+      if (bits < limit_bits && (bits & ((uint64_t(1) << 29) - 1)) == 0) {
+        uint64_t scaled = uint64_t(std::nearbyint(value * 1e6));
+        AppendDecimal(out, scaled / 1000000);
+
+        char frac[7];
+        uint64_t rest = scaled % 1000000;
+        frac[0] = '.';
+        for (int i = 6; i > 0; --i) {
+          frac[i] = char('0' + rest % 10);
+          rest /= 10;
+        }
+        out.append(frac, sizeof(frac));
+        return;
+      }
+
+      char buf[64];
+      int len = std::snprintf(buf, sizeof(buf), "%.6f", value);
+      if (len >= int(sizeof(buf))) {
+        std::string large(len + 1, '\0');
+        std::snprintf(&large[0], large.size(), "%.6f", value);
+        out.append(large.data(), len);
+      } else {
+        out.append(buf, len);
+      }
+    }
+
+    void AppendHex(std::string &out, uint64_t value) {
+      static const char digits[] = "0123456789abcdef";
+      char buf[16];
+      int i = sizeof(buf);
+      do {
+        buf[--i] = digits[value & 0xF];
+        value >>= 4;
+      } while (value);
+      out.append(buf + i, sizeof(buf) - i);
+    }
+
+    OutputWriter::OutputWriter(std::unique_ptr<ByteSink> sink, double flush_interval, size_t block_size) :
+            sink_(std::move(sink)),
+            flush_interval_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(flush_interval))),
+            block_size_(block_size),
+            last_flush_(std::chrono::steady_clock::now()) {
+      buffer_.reserve(block_size_ + block_size_ / 4);
+    }
+
+    OutputWriter::~OutputWriter() {
+      try {
+        if (!finished_)
+          finish();
+      } catch (...) {
+        // Destructors must not throw, and there is nobody left to tell
+      }
+    }
+
+    void OutputWriter::document_done() {
+      if (buffer_.size() >= block_size_) {
+        sink_->write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+      }
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - last_flush_ >= flush_interval_)
+        flush();
+    }
+
+    void OutputWriter::flush() {
+      sink_->write(buffer_.data(), buffer_.size());
+      buffer_.clear();
+      sink_->flush();
+      last_flush_ = std::chrono::steady_clock::now();
+    }
+
+    void OutputWriter::sync() {
+      sink_->write(buffer_.data(), buffer_.size());
+      buffer_.clear();
+      sink_->sync();
+      last_flush_ = std::chrono::steady_clock::now();
+    }
+
+    void OutputWriter::finish() {
+      finished_ = true;
+      sink_->write(buffer_.data(), buffer_.size());
+      buffer_.clear();
+      sink_->finish();
+    }
+
+} // namespace utils
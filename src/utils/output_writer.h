@@ -0,0 +1,61 @@
+
+#ifndef FAST_BLEUALIGN_OUTPUT_WRITER_H
+#define FAST_BLEUALIGN_OUTPUT_WRITER_H
+
+#include "compression.h"
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+
+namespace utils {
+
+    // Appends value formatted as std::fixed with std::setprecision(6) would
+    void AppendFixed6(std::string &out, double value);
+
+    // Appends value as lowercase hexadecimal without leading zeros, like std::hex
+    void AppendHex(std::string &out, uint64_t value);
+
+    // Collects the output text and hands it to a sink, possibly compressing, in
+    // large blocks instead of flushing after every document pair.
+    class OutputWriter {
+
+    public:
+
+        // A flush_interval of 0 seconds writes out after every document pair
+        explicit OutputWriter(std::unique_ptr<ByteSink> sink, double flush_interval = 1.0,
+                              size_t block_size = 1 << 20);
+
+        // Finishes the output stream if finish() was not called
+        ~OutputWriter();
+
+        // Text appended here is written out by flush() or document_done()
+        std::string &buffer() { return buffer_; }
+
+        // Called after each document pair. Writes the buffer once it holds
+        // block_size bytes or flush_interval has passed since the last write.
+        void document_done();
+
+        void flush();
+
+        // Flushes and ends the current compressed member or frame, so the
+        // output up to here decodes on its own even if the process dies
+        void sync();
+
+        // Flushes and terminates the (compressed) output stream
+        void finish();
+
+    private:
+        std::unique_ptr<ByteSink> sink_;
+        bool finished_ = false;
+        std::chrono::steady_clock::duration flush_interval_;
+        size_t block_size_;
+        std::chrono::steady_clock::time_point last_flush_;
+        std::string buffer_;
+
+    };
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_OUTPUT_WRITER_H
@@ -0,0 +1,379 @@
+#include "token_format.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+
+#include <boost/make_unique.hpp>
+
+namespace {
+
+  const char magic[8] = {'B', 'L', 'E', 'U', 'T', 'O', 'K', '\x01'};
+
+  const size_t size_prefix = 4;
+
+  void AppendVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(char(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(char(value));
+  }
+
+  void AppendString(std::string &out, boost::string_ref str) {
+    AppendVarint(out, str.size());
+    out.append(str.data(), str.size());
+  }
+
+  void AppendFixed64(std::string &out, uint64_t value) {
+    char bytes[8];
+    for (int i = 0; i < 8; ++i)
+      bytes[i] = char(value >> (8 * i));
+    out.append(bytes, 8);
+  }
+
+  void AppendSentences(std::string &out, const utils::SentenceBlock &block) {
+    size_t size = 0;
+    for (boost::string_ref sentence : block)
+      size += sentence.size() + 1;
+
+    AppendVarint(out, size);
+    for (boost::string_ref sentence : block)
+      out.append(sentence.data(), sentence.size()).push_back('\n');
+  }
+
+  void AppendTokens(std::string &out, const utils::TokenBlock &block) {
+    AppendVarint(out, block.size());
+    for (size_t i = 0; i < block.size(); ++i) {
+      AppendVarint(out, block.sentence_size(i));
+      for (const uint64_t *token = block.sentence_begin(i); token != block.sentence_end(i); ++token)
+        AppendFixed64(out, *token);
+    }
+  }
+
+  void AppendMetadata(std::string &out, const std::vector<std::vector<std::string>> &metadata, size_t sentences) {
+    std::string lines;
+    for (size_t i = 0; i < sentences; ++i) {
+      for (size_t j = 0; j < metadata[i].size(); ++j) {
+        if (j > 0)
+          lines.push_back('\t');
+        lines.append(metadata[i][j]);
+      }
+      lines.push_back('\n');
+    }
+    AppendString(out, lines);
+  }
+
+  // Starts a record, returns where its size goes once the payload is appended
+  size_t BeginRecord(std::string &out) {
+    out.append(size_prefix, '\0');
+    return out.size();
+  }
+
+  void EndRecord(std::string &out, size_t payload_start) {
+    uint64_t size = out.size() - payload_start;
+    if (size > UINT32_MAX)
+      throw std::runtime_error("Document pair too large for the pre-tokenized format");
+    for (size_t i = 0; i < size_prefix; ++i)
+      out[payload_start - size_prefix + i] = char(size >> (8 * i));
+  }
+
+  // Reads the fields of a record in order, throwing if it ends early
+  class RecordParser {
+
+  public:
+
+    RecordParser(boost::string_ref record, size_t n) :
+            pos_(record.data()), end_(record.data() + record.size()), n_(n) {};
+
+    uint64_t varint() {
+      uint64_t value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        if (pos_ == end_)
+          fail("is truncated");
+        uint8_t byte = uint8_t(*pos_++);
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          return value;
+      }
+      fail("has an invalid number");
+    }
+
+    boost::string_ref bytes(uint64_t size) {
+      if (uint64_t(end_ - pos_) < size)
+        fail("is truncated");
+      boost::string_ref result(pos_, size);
+      pos_ += size;
+      return result;
+    }
+
+    boost::string_ref string() {
+      return bytes(varint());
+    }
+
+    void sentences(utils::SentenceBlock &block) {
+      boost::string_ref text = string();
+      if (!text.empty() && text.back() != '\n')
+        fail("has an unterminated sentence");
+      block.buffer().assign(text.data(), text.size());
+      block.split('\n', true);
+    }
+
+    void tokens(utils::TokenBlock &block) {
+      block.clear();
+      uint64_t sentences = varint();
+      for (uint64_t i = 0; i < sentences; ++i) {
+        uint64_t count = varint();
+        // checked before multiplying, which a corrupt count could overflow
+        if (count > uint64_t(end_ - pos_) / 8)
+          fail("is truncated or corrupt");
+        const char *data = bytes(count * 8).data();
+        uint64_t *out = block.append_sentence(count);
+        for (uint64_t j = 0; j < count; ++j, data += 8) {
+          uint64_t value = 0;
+          for (int b = 0; b < 8; ++b)
+            value |= uint64_t(uint8_t(data[b])) << (8 * b);
+          out[j] = value;
+        }
+      }
+    }
+
+    bool done() const { return pos_ == end_; }
+
+    [[noreturn]] void fail(const std::string &what) const {
+      std::stringstream error;
+      if (n_ == 0)
+        error << "Header of pre-tokenized input " << what;
+      else
+        error << "Record " << n_ << " of pre-tokenized input " << what;
+      throw std::runtime_error(error.str());
+    }
+
+  private:
+    const char *pos_;
+    const char *end_;
+    size_t n_;
+
+  };
+
+  void ReadMetadata(RecordParser &parser, std::vector<std::vector<std::string>> &metadata,
+                    size_t sentences, size_t fields, const char *column) {
+    std::vector<boost::string_ref> lines;
+    utils::SplitString(lines, parser.string(), '\n', true);
+
+    if (lines.size() != sentences) {
+      std::stringstream error;
+      error << column << " has " << lines.size() << " lines of metadata for " << sentences << " sentences";
+      parser.fail(error.str());
+    }
+
+    if (metadata.size() < sentences)
+      metadata.resize(sentences);
+
+    std::vector<boost::string_ref> split;
+    for (size_t i = 0; i < sentences; ++i) {
+      utils::SplitString(split, lines[i], '\t');
+      if (split.size() != fields) {
+        std::stringstream error;
+        error << column << " has " << split.size() << " metadata fields, but the header lists " << fields;
+        parser.fail(error.str());
+      }
+      metadata[i].resize(fields);
+      for (size_t j = 0; j < fields; ++j)
+        metadata[i][j].assign(split[j].data(), split[j].size());
+    }
+  }
+
+  // Hands out the payload of each record, which is only valid until the next call
+  class TokenRecordReader : public utils::LineReader {
+
+  public:
+
+    TokenRecordReader(std::unique_ptr<utils::ByteSource> source, const std::string &name) :
+            source_(std::move(source)), name_(name), buffer_(1 << 22) {
+      if (!fill(sizeof(magic)) || std::memcmp(buffer_.data(), magic, sizeof(magic)) != 0)
+        throw std::runtime_error(name_ + " is not pre-tokenized input, convert it with bleualign_cpp_pretokenize");
+      begin_ = sizeof(magic);
+    }
+
+    bool read_line(boost::string_ref &record) override {
+      if (!fill(size_prefix)) {
+        if (begin_ == end_)
+          return false;
+        truncated();
+      }
+
+      const char *prefix = buffer_.data() + begin_;
+      size_t size = 0;
+      for (size_t i = 0; i < size_prefix; ++i)
+        size |= size_t(uint8_t(prefix[i])) << (8 * i);
+
+      if (!fill(size_prefix + size))
+        truncated();
+
+      record = boost::string_ref(buffer_.data() + begin_ + size_prefix, size);
+      begin_ += size_prefix + size;
+      return true;
+    }
+
+    bool lines_persist() const override { return false; }
+
+    uint64_t offset() const override { return base_ + begin_; }
+
+    void skip_to(uint64_t offset) override {
+      if (offset >= base_ && offset <= base_ + end_) {
+        begin_ = offset - base_;
+        return;
+      }
+
+      base_ += end_;
+      begin_ = end_ = 0;
+      if (source_->seek(offset)) {
+        base_ = offset;
+        return;
+      }
+
+      if (offset < base_)
+        throw std::runtime_error("Cannot go back in " + name_);
+      while (base_ + end_ < offset) {
+        base_ += end_;
+        end_ = source_->read(buffer_.data(), buffer_.size());
+        if (end_ == 0)
+          throw std::runtime_error(name_ + " is shorter than the checkpoint offset");
+      }
+      begin_ = offset - base_;
+    }
+
+  private:
+
+    // Makes sure size bytes are buffered from begin_, false if the input ends first
+    bool fill(size_t size) {
+      if (end_ - begin_ >= size)
+        return true;
+
+      // Move the unread bytes to the front, growing the buffer for large records
+      std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+      base_ += begin_;
+      end_ -= begin_;
+      begin_ = 0;
+      if (buffer_.size() < size)
+        buffer_.resize(std::max(size, buffer_.size() * 2));
+
+      while (end_ < size) {
+        size_t got = source_->read(buffer_.data() + end_, buffer_.size() - end_);
+        if (got == 0)
+          return false;
+        end_ += got;
+      }
+      return true;
+    }
+
+    [[noreturn]] void truncated() const {
+      throw std::runtime_error("Pre-tokenized input " + name_ + " is truncated");
+    }
+
+    std::unique_ptr<utils::ByteSource> source_;
+    std::string name_;
+    std::vector<char> buffer_;
+    uint64_t base_ = 0; // offset of buffer_[0] in the input
+    size_t begin_ = 0;
+    size_t end_ = 0;
+
+  };
+
+}
+
+namespace utils {
+
+    void WriteTokenHeader(std::string &out, const TokenFileHeader &header) {
+      out.append(magic, sizeof(magic));
+
+      size_t start = BeginRecord(out);
+      AppendVarint(out, header.version);
+      AppendString(out, header.normalizer);
+      AppendVarint(out, header.metadata_fields.size());
+      for (const std::string &field : header.metadata_fields)
+        AppendString(out, field);
+      EndRecord(out, start);
+    }
+
+    void WriteTokenRecord(std::string &out, const DocumentPair &doc_pair, const TokenFileHeader &header) {
+      size_t start = BeginRecord(out);
+      AppendString(out, doc_pair.url1);
+      AppendString(out, doc_pair.url2);
+      AppendSentences(out, doc_pair.text1);
+      AppendSentences(out, doc_pair.text2);
+      AppendTokens(out, doc_pair.text1tokens);
+      AppendTokens(out, doc_pair.text2tokens);
+      if (!header.metadata_fields.empty()) {
+        AppendMetadata(out, doc_pair.text1metadata, doc_pair.text1.size());
+        AppendMetadata(out, doc_pair.text2metadata, doc_pair.text2.size());
+      }
+      EndRecord(out, start);
+    }
+
+    std::unique_ptr<LineReader> OpenTokenReader(const std::string &filename) {
+      return boost::make_unique<TokenRecordReader>(OpenByteSource(filename), filename == "-" ? "stdin" : filename);
+    }
+
+    TokenFileHeader ReadTokenHeader(LineReader &in) {
+      boost::string_ref record;
+      if (!in.read_line(record))
+        throw std::runtime_error("Pre-tokenized input has no header");
+
+      RecordParser parser(record, 0);
+      TokenFileHeader header;
+      header.version = parser.varint();
+      if (header.version == 1)
+        parser.fail("has version 1 tokens, which were lowercased differently, convert it again with "
+                    "bleualign_cpp_pretokenize");
+      if (header.version != 2)
+        parser.fail("has unsupported version " + std::to_string(header.version));
+
+      header.normalizer = parser.string().to_string();
+      uint64_t fields = parser.varint();
+      for (uint64_t i = 0; i < fields; ++i)
+        header.metadata_fields.push_back(parser.string().to_string());
+
+      return header;
+    }
+
+    void ReadTokenRecordUrls(boost::string_ref &url1, boost::string_ref &url2, boost::string_ref record, size_t n) {
+      RecordParser parser(record, n);
+      url1 = parser.string();
+      url2 = parser.string();
+    }
+
+    void ReadTokenRecord(DocumentPair &doc_pair, boost::string_ref record, size_t n, const TokenFileHeader &header,
+                         bool read_metadata) {
+      RecordParser parser(record, n);
+
+      doc_pair.pretokenized = true;
+      doc_pair.text2translated_provided = false;
+      doc_pair.url1 = parser.string().to_string();
+      doc_pair.url2 = parser.string().to_string();
+      parser.sentences(doc_pair.text1);
+      parser.sentences(doc_pair.text2);
+      parser.tokens(doc_pair.text1tokens);
+      parser.tokens(doc_pair.text2tokens);
+
+      if (doc_pair.text1tokens.size() != doc_pair.text1.size())
+        parser.fail("has tokens for a different number of sentences than text1");
+      if (doc_pair.text2tokens.size() != doc_pair.text2.size())
+        parser.fail("has tokens for a different number of sentences than text2");
+
+      if (read_metadata) {
+        size_t fields = header.metadata_fields.size();
+        ReadMetadata(parser, doc_pair.text1metadata, doc_pair.text1.size(), fields, "metadata1");
+        ReadMetadata(parser, doc_pair.text2metadata, doc_pair.text2.size(), fields, "metadata2");
+      } else if (!header.metadata_fields.empty()) {
+        parser.string();
+        parser.string();
+      }
+
+      if (!parser.done())
+        parser.fail("has trailing bytes");
+    }
+
+} // namespace utils
@@ -0,0 +1,62 @@
+
+#ifndef FAST_BLEUALIGN_TOKEN_FORMAT_H
+#define FAST_BLEUALIGN_TOKEN_FORMAT_H
+
+#include "common.h"
+#include "line_reader.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <boost/utility/string_ref.hpp>
+
+namespace utils {
+
+    // Binary container for document pairs that were already normalized and
+    // tokenized, as written by bleualign_cpp_pretokenize.
+    //
+    // After the 8 magic bytes "BLEUTOK\x01" the file is a sequence of records,
+    // each a 4 byte little-endian payload size followed by the payload. The
+    // first record is the header, every other record a document pair:
+    //
+    //   header:   version, normalizer name, metadata field count, field names
+    //   document: url1, url2,
+    //             text1, text2 (sentences each terminated by '\n'),
+    //             tokens1, tokens2 (per sentence a token count and its tokens),
+    //             [metadata1, metadata2 (one line per sentence, fields separated by '\t')]
+    //
+    // Numbers are LEB128 varints and strings are prefixed by their size. Tokens
+    // are 8 byte little-endian ngram::get_token_hash values. tokens1 holds the
+    // tokens of text1translated, tokens2 those of text2translated or text2.
+    //
+    // Version 2 tokens are lowercased with Unicode case folding, version 1
+    // lowercased ASCII only and is no longer read.
+    struct TokenFileHeader {
+        uint64_t version = 2;
+        std::string normalizer = "western";
+        std::vector<std::string> metadata_fields;
+    };
+
+    // Appends the magic bytes and the header record
+    void WriteTokenHeader(std::string &out, const TokenFileHeader &header);
+
+    // Appends doc_pair as a record, with the tokens in text1tokens and text2tokens
+    void WriteTokenRecord(std::string &out, const DocumentPair &doc_pair, const TokenFileHeader &header);
+
+    // Reads records from a pre-tokenized file, "-" for stdin. Compressed files
+    // are decoded like OpenLineReader does. Throws if the magic bytes are missing.
+    std::unique_ptr<LineReader> OpenTokenReader(const std::string &filename);
+
+    TokenFileHeader ReadTokenHeader(LineReader &in);
+
+    // Points url1 and url2 into record n without decoding the rest of it
+    void ReadTokenRecordUrls(boost::string_ref &url1, boost::string_ref &url2, boost::string_ref record, size_t n);
+
+    // Fills doc_pair from record n, skipping the metadata unless read_metadata
+    void ReadTokenRecord(DocumentPair &doc_pair, boost::string_ref record, size_t n, const TokenFileHeader &header,
+                         bool read_metadata);
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_TOKEN_FORMAT_H
@@ -0,0 +1,227 @@
+#include "tsv_format.h"
+#include "base64.h"
+
+#include <sstream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+
+  template <typename Sentences>
+  void DecodeColumn(Sentences &sentences, const std::vector<boost::string_ref> &split_line, size_t n, int column) {
+    try {
+      utils::DecodeAndSplit(sentences, split_line[column], '\n', true);
+    } catch (const utils::Base64Error &e) {
+      std::stringstream error;
+      error << "On line " << n << " column " << column + 1 << " is not valid base64: " << e.what();
+      throw std::runtime_error(error.str());
+    }
+  }
+
+}
+
+namespace utils {
+
+    std::vector<std::string> GetMandatoryHeaderFields(const std::vector<std::string> &split_metadata_headers) {
+      std::vector<std::string> header_mandatory_values = {"src_url", "trg_url", "src_text", "trg_text", "src_translated"};
+
+      if (split_metadata_headers.size() != 0) {
+        header_mandatory_values.push_back("src_metadata");
+        header_mandatory_values.push_back("trg_metadata");
+      }
+
+      return header_mandatory_values;
+    }
+
+    std::unordered_map<std::string, int> ReadTsvHeader(LineReader &in,
+                                                       const std::vector<std::string> &split_metadata_headers) {
+      boost::string_ref line;
+      std::vector<std::string> split_line;
+
+      // Read header
+      if (in.read_line(line))
+        SplitString(split_line, line.to_string(), '\t');
+
+      std::unordered_map<std::string, int> header;
+      std::vector<std::string> header_mandatory_values = GetMandatoryHeaderFields(split_metadata_headers);
+
+      for (size_t i = 0; i < split_line.size(); ++i) {
+        // Get all fields
+        header[split_line[i]] = i;
+
+        // Check out if it is a mandatory field
+        auto find_result = std::find(header_mandatory_values.begin(), header_mandatory_values.end(), split_line[i]);
+
+        if (find_result != std::end(header_mandatory_values)) {
+          header_mandatory_values.erase(find_result);
+        }
+      }
+
+      if (header_mandatory_values.size() != 0) {
+        // Not all mandatory fields were provided
+        std::stringstream error;
+
+        error << "Mandatory fields not found in header:";
+
+        for (std::string h : header_mandatory_values) {
+          error << ' ' << h;
+        }
+
+        throw std::runtime_error(error.str());
+      }
+
+      return header;
+    }
+
+    size_t CountFields(boost::string_ref line) {
+      if (line.empty())
+        return 0;
+
+      return std::count(line.begin(), line.end(), '\t') + 1;
+    }
+
+    boost::string_ref GetField(boost::string_ref line, size_t column) {
+      const char *begin = line.data();
+      const char *end = line.data() + line.size();
+
+      for (size_t i = 0; i < column; ++i) {
+        const char *tab = static_cast<const char *>(std::memchr(begin, '\t', end - begin));
+        if (!tab)
+          return boost::string_ref();
+        begin = tab + 1;
+      }
+
+      const char *tab = static_cast<const char *>(std::memchr(begin, '\t', end - begin));
+      return boost::string_ref(begin, (tab ? tab : end) - begin);
+    }
+
+    void ReadScoringColumns(DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line, boost::string_ref line,
+                            size_t n, size_t columns, const std::unordered_map<std::string, int> &header_idxs,
+                            const std::vector<std::string> &header_mandatory_fields) {
+      SplitString(split_line, line, '\t');
+
+      // Expect at least 5 (maybe 6 or more if metadata is present) columns
+      if (split_line.size() < header_mandatory_fields.size()) {
+        std::stringstream error;
+        error << "Not enough fields on line " << n << " mandatory header fields are:";
+
+        for (const std::string &field : header_mandatory_fields) {
+          error << " " << field;
+        }
+
+        throw std::runtime_error(error.str());
+      }
+      // Check that the number of fields is the expected, since all the lines should contain the same number of fields
+      if (columns != split_line.size()) {
+        std::stringstream error;
+        error << "Different number of fields obtained on line " << n;
+        throw std::runtime_error(error.str());
+      }
+
+      doc_pair.pretokenized = false;
+      doc_pair.url1 = split_line[header_idxs.at("src_url")].to_string();
+      doc_pair.url2 = split_line[header_idxs.at("trg_url")].to_string();
+
+      // Processed version of text 1 (i.e. translated to match language text 2)
+      DecodeColumn(doc_pair.text1translated, split_line, n, header_idxs.at("src_translated"));
+
+      // Optionally sixth column with processed version of text 2 (i.e. to better
+      // match with the processed version of text 1), otherwise text 2 is scored
+      if (header_idxs.find("trg_translated") == header_idxs.end()) {
+        doc_pair.text2translated_provided = false;
+        DecodeColumn(doc_pair.text2, split_line, n, header_idxs.at("trg_text"));
+      } else {
+        doc_pair.text2translated_provided = true;
+        DecodeColumn(doc_pair.text2translated, split_line, n, header_idxs.at("trg_translated"));
+      }
+    }
+
+    void ReadOutputColumns(DocumentPair &doc_pair, const std::vector<boost::string_ref> &split_line, size_t n,
+                           const std::unordered_map<std::string, int> &header_idxs,
+                           const std::vector<std::string> &split_metadata_headers) {
+      bool metadata = split_metadata_headers.size() != 0 ? true : false;
+
+      DecodeColumn(doc_pair.text1, split_line, n, header_idxs.at("src_text"));
+      if (doc_pair.text1.size() != doc_pair.text1translated.size()) {
+        std::stringstream error;
+        error << "On line " << n << " column " << header_idxs.at("src_text") + 1 << " and "
+              << header_idxs.at("src_translated") + 1 << " don't have an equal number of lines "
+              << "(" << doc_pair.text1.size() << " vs " << doc_pair.text1translated.size() << ")";
+        throw std::runtime_error(error.str());
+      }
+
+      if (doc_pair.text2translated_provided) {
+        DecodeColumn(doc_pair.text2, split_line, n, header_idxs.at("trg_text"));
+
+        if (doc_pair.text2.size() != doc_pair.text2translated.size()) {
+          std::stringstream error;
+          error << "On line " << n << " column " << header_idxs.at("trg_text") + 1 << " and "
+                << header_idxs.at("trg_translated") + 1 << " don't have an equal number of lines "
+                << "(" << doc_pair.text2.size() << " vs " << doc_pair.text2translated.size() << ")";
+          throw std::runtime_error(error.str());
+        }
+      }
+
+      // Process metadata, if provided
+      if (metadata) {
+        std::vector<std::string> metadata1, metadata2;
+        DecodeColumn(metadata1, split_line, n, header_idxs.at("src_metadata"));
+        DecodeColumn(metadata2, split_line, n, header_idxs.at("trg_metadata"));
+
+        if (doc_pair.text1.size() != metadata1.size()) {
+          std::stringstream error;
+          error << "On line " << n << " column " << header_idxs.at("src_text") + 1 << " and "
+                << header_idxs.at("src_metadata") + 1 << " don't have an equal number of lines "
+                << "(" << doc_pair.text1.size() << " vs " << metadata1.size() << ")";
+          throw std::runtime_error(error.str());
+        }
+        if (doc_pair.text2.size() != metadata2.size()) {
+          std::stringstream error;
+          error << "On line " << n << " column " << header_idxs.at("trg_text") + 1 << " and "
+                << header_idxs.at("trg_metadata") + 1 << " don't have an equal number of lines "
+                << "(" << doc_pair.text2.size() << " vs " << metadata2.size() << ")";
+          throw std::runtime_error(error.str());
+        }
+
+        if (doc_pair.text1metadata.size() < doc_pair.text1.size()) {
+          doc_pair.text1metadata.resize(doc_pair.text1.size());
+        }
+        if (doc_pair.text2metadata.size() < doc_pair.text2.size()) {
+          doc_pair.text2metadata.resize(doc_pair.text2.size());
+        }
+
+        for (size_t i = 0; i < metadata1.size(); ++i) {
+          SplitString(doc_pair.text1metadata[i], metadata1[i], '\t');
+
+          if (doc_pair.text1metadata[i].size() != split_metadata_headers.size()) {
+            std::stringstream error;
+            error << "On line " << n << " column " << header_idxs.at("src_metadata") + 1 << " "
+                  << "has " << doc_pair.text1metadata[i].size() << " fields, but "
+                  << split_metadata_headers.size() << " were provided";
+            throw std::runtime_error(error.str());
+          }
+        }
+        for (size_t i = 0; i < metadata2.size(); ++i) {
+          SplitString(doc_pair.text2metadata[i], metadata2[i], '\t');
+
+          if (doc_pair.text2metadata[i].size() != split_metadata_headers.size()) {
+            std::stringstream error;
+            error << "On line " << n << " column " << header_idxs.at("trg_metadata") + 1 << " "
+                  << "has " << doc_pair.text2metadata[i].size() << " fields, but "
+                  << split_metadata_headers.size() << " were provided";
+            throw std::runtime_error(error.str());
+          }
+        }
+      }
+    }
+
+    void ReadDocumentPair(DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line, boost::string_ref line,
+                          size_t n, size_t columns, const std::unordered_map<std::string, int> &header_idxs,
+                          const std::vector<std::string> &header_mandatory_fields,
+                          const std::vector<std::string> &split_metadata_headers) {
+      ReadScoringColumns(doc_pair, split_line, line, n, columns, header_idxs, header_mandatory_fields);
+      ReadOutputColumns(doc_pair, split_line, n, header_idxs, split_metadata_headers);
+    }
+
+} // namespace utils
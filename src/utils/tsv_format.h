@@ -0,0 +1,54 @@
+
+#ifndef FAST_BLEUALIGN_TSV_FORMAT_H
+#define FAST_BLEUALIGN_TSV_FORMAT_H
+
+#include "common.h"
+#include "line_reader.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/utility/string_ref.hpp>
+
+namespace utils {
+
+    // Header fields every input needs, src_metadata and trg_metadata included
+    // when metadata header fields are given
+    std::vector<std::string> GetMandatoryHeaderFields(const std::vector<std::string> &split_metadata_headers);
+
+    // Reads the header line and maps each field name to its column. Throws when
+    // a mandatory field is missing.
+    std::unordered_map<std::string, int> ReadTsvHeader(LineReader &in,
+                                                       const std::vector<std::string> &split_metadata_headers);
+
+    // Same number of fields SplitString would produce for the line
+    size_t CountFields(boost::string_ref line);
+
+    // Field column of a tab-separated line without splitting all of it, empty
+    // if the line has fewer fields
+    boost::string_ref GetField(boost::string_ref line, size_t column);
+
+    // Decodes the columns of line n that scoring needs: the urls, src_translated
+    // and trg_translated, or trg_text without a trg_translated column. All lines
+    // are expected to have the same number of columns. The fields are left in
+    // split_line for ReadOutputColumns.
+    void ReadScoringColumns(DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line, boost::string_ref line,
+                            size_t n, size_t columns, const std::unordered_map<std::string, int> &header_idxs,
+                            const std::vector<std::string> &header_mandatory_fields);
+
+    // Decodes the columns of line n only the output needs, src_text, trg_text
+    // and the metadata, and checks their line counts against the translations.
+    // Called once the document pair has matches to print.
+    void ReadOutputColumns(DocumentPair &doc_pair, const std::vector<boost::string_ref> &split_line, size_t n,
+                           const std::unordered_map<std::string, int> &header_idxs,
+                           const std::vector<std::string> &split_metadata_headers);
+
+    // Decodes all of line n into doc_pair. split_line is scratch space.
+    void ReadDocumentPair(DocumentPair &doc_pair, std::vector<boost::string_ref> &split_line, boost::string_ref line,
+                          size_t n, size_t columns, const std::unordered_map<std::string, int> &header_idxs,
+                          const std::vector<std::string> &header_mandatory_fields,
+                          const std::vector<std::string> &split_metadata_headers);
+
+} // namespace utils
+
+#endif //FAST_BLEUALIGN_TSV_FORMAT_H
@@ -1,14 +1,43 @@
 
 #include "gtest/gtest.h"
 #include "../src/align.h"
+#include "../src/scorer.h"
 
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <vector>
 #include <boost/make_unique.hpp>
 
 
 namespace {
 
+    // A sentence of length words picked by i, so that sentences with close
+    // numbers share some of their n-grams
+    std::string MakeSentence(size_t i, size_t length) {
+      static const std::vector<std::string> words = {"albania", "has", "a", "high", "birthrate", "and", "one",
+                                                     "million", "inhabitants", "before", "war", "three"};
+      std::string sentence;
+      for (size_t j = 0; j < length; ++j)
+        sentence += " " + words[(i * (j + 3) + j * j) % words.size()];
+      return sentence;
+    }
+
+    // actual holds the best candidates of every row of expected that fit into
+    // it, with the same scores to the last bit and the same counts
+    void ExpectSameCandidates(const utils::CandidateTable &actual, const utils::CandidateTable &expected) {
+      ASSERT_EQ(actual.rows(), expected.rows());
+      ASSERT_EQ(actual.order(), expected.order());
+      for (size_t i = 0; i < expected.rows(); ++i) {
+        ASSERT_EQ(actual.size(i), std::min(expected.size(i), actual.capacity()));
+        for (size_t k = 0; k < actual.size(i); ++k) {
+          ASSERT_EQ(actual.begin(i)[k].score, expected.begin(i)[k].score);
+          ASSERT_EQ(actual.begin(i)[k].index, expected.begin(i)[k].index);
+          ASSERT_TRUE(std::equal(actual.correct(i, k), actual.correct(i, k) + actual.order(), expected.correct(i, k)));
+        }
+      }
+    }
+
     TEST(align, test_align) {
 
       std::vector<std::string> text2_doc = {
@@ -43,20 +72,18 @@ namespace {
       std::vector<int> expected_correct_unigram = {7, 4, 5, 4, 7, 11, 10, 8, 7, 19, 9, 20, 6, 24, 8};
       std::vector<int> expected_correct_bigram = {5, 2, 4, 2, 2, 1, 6, 1, 5, 13, 2, 12, 4, 15, 2};
 
-      std::vector<utils::scoremap> scorelist;
+      utils::CandidateTable scorelist;
       align::EvalSents(scorelist, text1translated_doc, text2_doc, 2, 2);
 
       int pos = 0;
-      for (size_t s = 0; s < scorelist.size(); ++s) {
-        EXPECT_NEAR(scorelist.at(s).rbegin()->first, expected_scores.at(s), 0.01);
-
-        utils::scoremap::reverse_iterator rev_it = scorelist.at(s).rbegin();
-        while (rev_it != scorelist.at(s).rend()) {
-          ASSERT_EQ(rev_it->second.first, expected_refs.at(pos));
-          ASSERT_EQ(rev_it->second.second.at(0), expected_correct_unigram.at(pos));
-          ASSERT_EQ(rev_it->second.second.at(1), expected_correct_bigram.at(pos));
+      for (size_t s = 0; s < scorelist.rows(); ++s) {
+        EXPECT_NEAR(scorelist.begin(s)->score, expected_scores.at(s), 0.01);
+
+        for (size_t k = 0; k < scorelist.size(s); ++k) {
+          ASSERT_EQ(scorelist.begin(s)[k].index, expected_refs.at(pos));
+          ASSERT_EQ(scorelist.correct(s, k)[0], expected_correct_unigram.at(pos));
+          ASSERT_EQ(scorelist.correct(s, k)[1], expected_correct_bigram.at(pos));
           ++pos;
-          ++rev_it;
         }
 
       }
@@ -77,13 +104,234 @@ namespace {
               "this is now everything undone .",
       };
 
-      std::vector<utils::scoremap> scorelist;
+      utils::CandidateTable scorelist;
       align::EvalSents(scorelist, text1translated_doc, text2_doc, 2, 2);
-      ASSERT_EQ(scorelist.size(), 3);
+      ASSERT_EQ(scorelist.rows(), 3);
 
     }
 
 
+    TEST(align, test_align_ngram_orders) {
+
+      std::vector<std::string> text1translated_doc = {
+              "skip to the content of the page .",
+              "with friends and guests .",
+      };
+      std::vector<std::string> text2_doc = {
+              "with friends and guests .",
+              "skip to the content of the page .",
+              "skip to the navigation .",
+      };
+
+      for (unsigned short n = 1; n <= align::max_ngram_order; ++n) {
+        utils::CandidateTable scorelist;
+        align::EvalSents(scorelist, text1translated_doc, text2_doc, n, 2);
+        ASSERT_EQ(scorelist.rows(), 2u);
+
+        // The best match is the same sentence, whose 8 tokens make 9 - o n-grams of order o
+        const utils::CandidateTable::Candidate *best = scorelist.begin(0);
+        ASSERT_FLOAT_EQ(best->score, 1);
+        ASSERT_EQ(best->index, 1u);
+        std::vector<int> expected_correct = {8, 7, 6, 5};
+        expected_correct.resize(n);
+        ASSERT_EQ(std::vector<int>(scorelist.correct(0, 0), scorelist.correct(0, 0) + n), expected_correct);
+
+        // The navigation sentence shares "skip to the ." but no 4-gram
+        ASSERT_EQ(scorelist.size(0), n < 4 ? 2u : 1u);
+      }
+
+      utils::CandidateTable scorelist;
+      ASSERT_THROW(align::EvalSents(scorelist, text1translated_doc, text2_doc, align::max_ngram_order + 1, 2),
+                   std::runtime_error);
+    }
+
+
+    TEST(align, test_align_candidates) {
+      // Every third sentence starts with "of the", which is too frequent to
+      // take the candidates of the sentences with it from the inverted index
+      auto make_sentence = [](size_t i) {
+        return (i % 3 == 0 ? "of the" : "") + MakeSentence(i, 4 + i % 6);
+      };
+
+      std::vector<std::string> text1translated_doc, text2_doc, text2_first, text2_second;
+      for (size_t i = 0; i < 12; ++i)
+        text1translated_doc.push_back(make_sentence(i * 5 + 1));
+      for (size_t i = 0; i < 48; ++i) {
+        text2_doc.push_back(make_sentence(i));
+        (i < 24 ? text2_first : text2_second).push_back(make_sentence(i));
+      }
+
+      for (unsigned short n = 1; n <= align::max_ngram_order; ++n) {
+        // Halves that are too short for an inverted index score every pair
+        utils::CandidateTable scorelist, first, second;
+        align::EvalSents(scorelist, text1translated_doc, text2_doc, n, 1000);
+        align::EvalSents(first, text1translated_doc, text2_first, n, 1000);
+        align::EvalSents(second, text1translated_doc, text2_second, n, 1000);
+
+        // The halves scored separately, ranked like the table ranks them
+        struct Scored {
+          float score;
+          size_t index;
+          std::vector<int> correct;
+        };
+        auto add_row = [n](std::vector<Scored> &row, const utils::CandidateTable &table, size_t i, size_t offset) {
+          for (size_t k = 0; k < table.size(i); ++k)
+            row.push_back({table.begin(i)[k].score, table.begin(i)[k].index + offset,
+                           std::vector<int>(table.correct(i, k), table.correct(i, k) + n)});
+        };
+
+        ASSERT_EQ(scorelist.rows(), text1translated_doc.size());
+        for (size_t i = 0; i < scorelist.rows(); ++i) {
+          std::vector<Scored> expected;
+          add_row(expected, first, i, 0);
+          add_row(expected, second, i, text2_first.size());
+          std::sort(expected.begin(), expected.end(), [](const Scored &a, const Scored &b) {
+            return a.score > b.score || (a.score == b.score && a.index > b.index);
+          });
+
+          // The same scores to the last bit, in the same order
+          ASSERT_EQ(scorelist.size(i), expected.size());
+          for (size_t k = 0; k < expected.size(); ++k) {
+            ASSERT_EQ(scorelist.begin(i)[k].index, expected[k].index);
+            ASSERT_EQ(scorelist.begin(i)[k].score, expected[k].score);
+            ASSERT_EQ(std::vector<int>(scorelist.correct(i, k), scorelist.correct(i, k) + n), expected[k].correct);
+          }
+        }
+      }
+    }
+
+
+    TEST(align, test_align_pruning) {
+      // Sentences of very different lengths, so that the short ones cannot
+      // beat an alternative of about their own length
+      std::vector<std::string> text1translated_doc, text2_doc;
+      for (size_t i = 0; i < 6; ++i)
+        text1translated_doc.push_back(MakeSentence(i * 2 + 1, 20));
+      for (size_t i = 0; i < 12; ++i)
+        text2_doc.push_back(MakeSentence(i * 2 + 1, i % 2 == 0 ? 20 : 3));
+
+      for (size_t maxalternatives = 1; maxalternatives <= 3; ++maxalternatives) {
+        align::PruningStats before = align::GetPruningStats();
+        utils::CandidateTable scorelist, all;
+        align::EvalSents(scorelist, text1translated_doc, text2_doc, 2, maxalternatives);
+        align::PruningStats after = align::GetPruningStats();
+        ASSERT_GT(after.pruned, before.pruned);
+        ASSERT_LE(after.pruned - before.pruned, after.pairs - before.pairs);
+
+        // Pruning keeps the alternatives that trimming all scores keeps
+        align::EvalSents(all, text1translated_doc, text2_doc, 2, text2_doc.size());
+        ExpectSameCandidates(scorelist, all);
+      }
+    }
+
+
+    // Enough sentences for EvalSents to split them over threads
+    void MakeLargeDocuments(std::vector<std::string> &text1translated_doc, std::vector<std::string> &text2_doc) {
+      for (size_t i = 0; i < 2100; ++i) {
+        text1translated_doc.push_back(MakeSentence(i * 7 + 1, 3 + i % 9));
+        text2_doc.push_back(MakeSentence(i, 3 + i % 9));
+      }
+    }
+
+    TEST(align, test_align_parallel) {
+      std::vector<std::string> text1translated_doc, text2_doc;
+      MakeLargeDocuments(text1translated_doc, text2_doc);
+      ASSERT_GE(text1translated_doc.size() * text2_doc.size(), align::min_parallel_pairs);
+
+      for (size_t maxalternatives : {3, 40}) {
+        utils::CandidateTable expected, scorelist;
+        align::EvalSents(expected, text1translated_doc, text2_doc, 2, maxalternatives);
+        align::SetScoringThreads(3);
+        align::EvalSents(scorelist, text1translated_doc, text2_doc, 2, maxalternatives);
+        align::SetScoringThreads(1);
+        ExpectSameCandidates(scorelist, expected);
+      }
+    }
+
+
+    TEST(align, test_align_thread_limit) {
+      // More threads scoring large documents at once than SetScoringThreads
+      // allows, so that some of them wait and no helper is left idle
+      std::vector<std::string> text1translated_doc, text2_doc;
+      MakeLargeDocuments(text1translated_doc, text2_doc);
+
+      utils::CandidateTable expected;
+      align::EvalSents(expected, text1translated_doc, text2_doc, 2, 3);
+
+      align::SetScoringThreads(3);
+      std::vector<utils::CandidateTable> scorelists(4);
+      std::vector<std::thread> callers;
+      for (utils::CandidateTable &scorelist : scorelists) {
+        utils::CandidateTable *out = &scorelist;
+        callers.emplace_back([&, out] { align::EvalSents(*out, text1translated_doc, text2_doc, 2, 3); });
+      }
+      for (std::thread &t : callers)
+        t.join();
+      size_t peak = align::GetPeakScoringThreads();
+      align::SetScoringThreads(1);
+
+      ASSERT_LE(peak, 3);
+      for (const utils::CandidateTable &scorelist : scorelists)
+        ExpectSameCandidates(scorelist, expected);
+    }
+
+
+    TEST(align, test_EvalSents_tokens) {
+      // Scoring token hashes must rank and count exactly like scoring the text
+      std::vector<std::string> text1translated = {
+              "Skip to the content .",
+              "with friends and guests share them if need be her last bit bread .",
+              "this was also the vendetta longer than elsewhere .",
+              "this is now everything undone .",
+      };
+      std::vector<std::string> text2 = {
+              "Skip to the content.",
+              "With friends and guests to share them if necessary their last piece of bread.",
+              "This is now everything has been undone.",
+              "There was also the blood revenge longer than elsewhere.",
+      };
+
+      utils::TokenBlock tokens1, tokens2;
+      scorer::normalize(tokens1, text1translated, "western");
+      scorer::normalize(tokens2, text2, "western");
+
+      utils::CandidateTable expected, scorelist;
+      align::EvalSents(expected, text1translated, text2, 2, 3);
+      align::EvalSents(scorelist, tokens1, tokens2, 2, 3);
+
+      ExpectSameCandidates(scorelist, expected);
+
+      utils::matches_vec expected_matches, matches;
+      align::Align(expected_matches, utils::SentenceBlock(text1translated), utils::SentenceBlock(text2), 0.0);
+      align::Align(matches, tokens1, tokens2, 0.0);
+      ASSERT_EQ(matches, expected_matches);
+    }
+
+
+    TEST(align, test_align_cjk) {
+      // 我们明天去北京 / 明天我们去北京吧, 天气很好 / 今天天气很好
+      std::vector<std::string> text1translated_doc = {
+              "\xe6\x88\x91\xe4\xbb\xac\xe6\x98\x8e\xe5\xa4\xa9\xe5\x8e\xbb\xe5\x8c\x97\xe4\xba\xac",
+              "\xe5\xa4\xa9\xe6\xb0\x94\xe5\xbe\x88\xe5\xa5\xbd",
+      };
+      std::vector<std::string> text2_doc = {
+              "\xe6\x98\x8e\xe5\xa4\xa9\xe6\x88\x91\xe4\xbb\xac\xe5\x8e\xbb\xe5\x8c\x97\xe4\xba\xac\xe5\x90\xa7",
+              "\xe4\xbb\x8a\xe5\xa4\xa9\xe5\xa4\xa9\xe6\xb0\x94\xe5\xbe\x88\xe5\xa5\xbd",
+      };
+
+      utils::matches_vec matches;
+      align::Align(matches, text1translated_doc, text2_doc, 0.0);
+      ASSERT_TRUE(matches.empty());
+
+      align::Align(matches, text1translated_doc, text2_doc, 0.0, "cjk");
+      ASSERT_EQ(matches.size(), 2u);
+      ASSERT_EQ(matches[0].first.from, 0u);
+      ASSERT_EQ(matches[0].second.from, 0u);
+      ASSERT_EQ(matches[1].first.from, 1u);
+      ASSERT_EQ(matches[1].second.from, 1u);
+    }
+
+
     TEST(align, test_GapFiller1) {
       utils::matches_vec matched = {
               utils::match(0, 0, 0, 0, 0.0),
@@ -546,6 +794,47 @@ namespace {
     }
 
 
+    TEST(align, test_ProduceMergedSentences_counts) {
+      std::vector<std::string> text_doc = {
+              "Two seats were vacant.",
+              "it won't suit me.",
+              "",
+              "We need to rent a room for our party.",
+              "Abstraction is often one floor above you.",
+      };
+
+      utils::TokenBlock tokens;
+      scorer::normalize(tokens, text_doc, "western");
+      std::vector<ngram::NGramCounter> counts;
+      for (size_t i = 0; i < tokens.size(); ++i) {
+        counts.emplace_back(2);
+        counts.back().process(tokens.sentence_begin(i), tokens.sentence_end(i));
+      }
+
+      // Appending counts must give the counts of the merged tokens
+      for (bool reverse : {false, true}) {
+        std::vector<ngram::NGramCounter> merged_counts;
+        utils::vec_pair merged_pos;
+        align::ProduceMergedSentences(merged_counts, merged_pos, counts, 0, 4, 4, reverse);
+
+        ASSERT_EQ(merged_counts.size(), 4u);
+        for (size_t i = 0; i < merged_counts.size(); ++i) {
+          ASSERT_EQ(merged_pos[i], reverse ? std::make_pair(size_t(4 - i), size_t(4)) : std::make_pair(size_t(0), i));
+          std::vector<uint64_t> merged_tokens;
+          for (size_t j = merged_pos[i].first; j <= merged_pos[i].second; ++j)
+            merged_tokens.insert(merged_tokens.end(), tokens.sentence_begin(j), tokens.sentence_end(j));
+
+          ngram::NGramCounter expected(2);
+          expected.process(merged_tokens.data(), merged_tokens.data() + merged_tokens.size());
+          ASSERT_EQ(merged_counts[i].processed(), expected.processed());
+          for (unsigned short order = 1; order <= 2; ++order)
+            ASSERT_EQ(ngram::ngram_vector(merged_counts[i].cbegin(order), merged_counts[i].cend(order)),
+                      ngram::ngram_vector(expected.cbegin(order), expected.cend(order)));
+        }
+      }
+    }
+
+
     TEST(align, test_PreGapMergedSentences1) {
       std::vector<std::string> merged_text;
       utils::vec_pair merged_pos;
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+#include "../src/utils/base64.h"
+
+#include <string>
+#include <random>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+
+
+namespace {
+
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string Encode(const std::string &data, bool pad) {
+      std::string res;
+      size_t i = 0;
+      for (; i + 3 <= data.size(); i += 3) {
+        unsigned v = (unsigned char) data[i] << 16 | (unsigned char) data[i + 1] << 8 | (unsigned char) data[i + 2];
+        res += alphabet[v >> 18];
+        res += alphabet[(v >> 12) & 63];
+        res += alphabet[(v >> 6) & 63];
+        res += alphabet[v & 63];
+      }
+      if (data.size() - i == 1) {
+        unsigned v = (unsigned char) data[i] << 16;
+        res += alphabet[v >> 18];
+        res += alphabet[(v >> 12) & 63];
+        if (pad) res += "==";
+      } else if (data.size() - i == 2) {
+        unsigned v = (unsigned char) data[i] << 16 | (unsigned char) data[i + 1] << 8;
+        res += alphabet[v >> 18];
+        res += alphabet[(v >> 12) & 63];
+        res += alphabet[(v >> 6) & 63];
+        if (pad) res += "=";
+      }
+      return res;
+    }
+
+    TEST(base64, test_DecodeBase64_roundtrip) {
+      std::mt19937 rng(42);
+      std::string decoded;
+
+      // Long enough inputs to go through the vector loops and every tail length
+      for (size_t len = 0; len < 300; ++len) {
+        std::string data;
+        for (size_t i = 0; i < len; ++i)
+          data += char(rng() & 0xFF);
+
+        utils::DecodeBase64(decoded, Encode(data, true));
+        ASSERT_EQ(decoded, data) << "padded, length " << len;
+
+        utils::DecodeBase64(decoded, Encode(data, false));
+        ASSERT_EQ(decoded, data) << "unpadded, length " << len;
+      }
+    }
+
+    TEST(base64, test_DecodeBase64_matches_boost) {
+      typedef boost::archive::iterators::transform_width<
+              boost::archive::iterators::binary_from_base64<std::string::const_iterator>, 8, 6> binary_text;
+
+      std::mt19937 rng(7);
+      std::string decoded;
+
+      for (size_t len = 1; len < 200; ++len) {
+        std::string encoded;
+        for (size_t i = 0; i < len * 4; ++i)
+          encoded += alphabet[rng() % 64];
+
+        std::string expected(binary_text(encoded.begin()), binary_text(encoded.end()));
+        utils::DecodeBase64(decoded, encoded);
+        ASSERT_EQ(decoded, expected);
+      }
+    }
+
+    TEST(base64, test_DecodeBase64_invalid) {
+      std::string encoded = Encode(std::string(120, 'x'), true);
+      std::string decoded;
+
+      for (size_t pos : {0, 5, 17, 40, 63, 100, 159}) {
+        std::string broken = encoded;
+        broken[pos] = '\n';
+        try {
+          utils::DecodeBase64(decoded, broken);
+          FAIL() << "no error for offset " << pos;
+        } catch (const utils::Base64Error &e) {
+          ASSERT_EQ(e.offset(), pos);
+        }
+      }
+
+      ASSERT_THROW(utils::DecodeBase64(decoded, "QQ=A"), utils::Base64Error);
+      ASSERT_THROW(utils::DecodeBase64(decoded, "QQ==="), utils::Base64Error);
+    }
+
+} // namespace
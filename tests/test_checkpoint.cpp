@@ -0,0 +1,61 @@
+#include "gtest/gtest.h"
+#include "../src/utils/checkpoint.h"
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+
+namespace {
+
+    std::string TempPath() {
+      char name[] = "/tmp/bleualign_checkpoint_XXXXXX";
+      int fd = mkstemp(name);
+      EXPECT_NE(fd, -1);
+      close(fd);
+      std::remove(name);
+      return name;
+    }
+
+    TEST(checkpoint, test_round_trip) {
+      std::string path = TempPath();
+
+      utils::Checkpoint checkpoint;
+      ASSERT_FALSE(utils::ReadCheckpoint(path, checkpoint));
+
+      checkpoint.file = 1;
+      checkpoint.filename = "input 2.tsv.gz";
+      checkpoint.line = 12345;
+      checkpoint.input_offset = uint64_t(1) << 40;
+      checkpoint.columns = 7;
+      checkpoint.output_offset = 987654321;
+      utils::WriteCheckpoint(path, checkpoint);
+
+      utils::Checkpoint read;
+      ASSERT_TRUE(utils::ReadCheckpoint(path, read));
+      ASSERT_EQ(read.file, checkpoint.file);
+      ASSERT_EQ(read.filename, checkpoint.filename);
+      ASSERT_EQ(read.line, checkpoint.line);
+      ASSERT_EQ(read.input_offset, checkpoint.input_offset);
+      ASSERT_EQ(read.columns, checkpoint.columns);
+      ASSERT_EQ(read.output_offset, checkpoint.output_offset);
+
+      std::remove(path.c_str());
+    }
+
+    TEST(checkpoint, test_invalid) {
+      std::string path = TempPath();
+
+      std::ofstream(path) << "file\t0\nfilename\t-\nline\t3\n";
+      utils::Checkpoint read;
+      ASSERT_THROW(utils::ReadCheckpoint(path, read), std::runtime_error);
+
+      std::ofstream(path) << "file\t0\nfilename\t-\nline\tthree\ninput_offset\t1\ncolumns\t5\noutput_offset\t2\n";
+      ASSERT_THROW(utils::ReadCheckpoint(path, read), std::runtime_error);
+
+      std::remove(path.c_str());
+    }
+
+} // namespace
@@ -2,6 +2,9 @@
 #include "gtest/gtest.h"
 #include "../src/utils/common.h"
 
+#include <algorithm>
+#include <utility>
+#include <vector>
 #include <boost/functional.hpp>
 
 
@@ -35,4 +38,90 @@ namespace {
       }
 
     }
+    TEST(utils, test_common_SentenceBlock) {
+
+      std::string s1("This is a text with many single spaces and   a  few     gaps   . ");
+
+      utils::SentenceBlock block1;
+      std::vector<std::string> s_vec1;
+      for (bool trim : {false, true}) {
+        utils::SplitString(block1, s1, ' ', trim);
+        utils::SplitString(s_vec1, s1, ' ', trim);
+        ASSERT_EQ(block1.size(), s_vec1.size());
+        for (size_t i = 0; i < s_vec1.size(); ++i) {
+          ASSERT_EQ(s_vec1.at(i), block1.at(i));
+        }
+      }
+
+      utils::SplitString(block1, "", ' ');
+      ASSERT_TRUE(block1.empty());
+      ASSERT_THROW(block1.at(0), std::out_of_range);
+
+      std::string s2("VGhpcyBpcyBhIHRleHQgd2l0aCBtYW55IHNpbmdsZSBzcGFjZXMgYW5kICAgYSAgZmV3ICAgICBnYXBzICAgLiA=");
+      utils::SentenceBlock block2;
+      utils::DecodeAndSplit(block2, s2, ' ', true);
+      utils::DecodeAndSplit(s_vec1, s2, ' ', true);
+      ASSERT_EQ(block2.size(), s_vec1.size());
+      size_t i = 0;
+      for (boost::string_ref sentence : block2) {
+        ASSERT_EQ(s_vec1.at(i++), sentence);
+      }
+
+      utils::SentenceBlock block3(s_vec1);
+      block3.push_back("last");
+      ASSERT_EQ(block3.size(), s_vec1.size() + 1);
+      ASSERT_EQ(block3[0], "This");
+      ASSERT_EQ(block3[block3.size() - 1], "last");
+    }
+
+    TEST(utils, test_common_CandidateTable) {
+
+      utils::CandidateTable table(3, 2);
+      table.add_row();
+      table.add_row();
+      ASSERT_EQ(table.rows(), 2u);
+      ASSERT_TRUE(table.empty(0));
+
+      int correct[][2] = {{1, 0}, {2, 1}, {3, 2}, {4, 3}, {5, 4}};
+      table.insert(1, 0.5, 0, correct[0]);
+      table.insert(1, 0.2, 1, correct[1]);
+      table.insert(1, 0.5, 2, correct[2]);
+      ASSERT_TRUE(table.full(1));
+      ASSERT_FLOAT_EQ(table.worst(1), 0.2);
+
+      // A full row drops its worst candidate, or the new one if it is worse,
+      // and of equal scores the later sentence ranks first
+      table.insert(1, 0.1, 3, correct[3]);
+      table.insert(1, 0.2, 4, correct[4]);
+      table.insert(1, 0.2, 1, correct[1]);
+      table.sort(1);
+      std::vector<size_t> expected_index = {2, 0, 4};
+      std::vector<int> expected_unigrams = {3, 1, 5};
+      ASSERT_EQ(table.size(1), 3u);
+      for (size_t k = 0; k < table.size(1); ++k) {
+        ASSERT_EQ(table.begin(1)[k].index, expected_index[k]);
+        ASSERT_EQ(table.correct(1, k)[0], expected_unigrams[k]);
+        ASSERT_EQ(table.correct(1, k)[1], expected_unigrams[k] - 1);
+      }
+      ASSERT_TRUE(table.empty(0));
+
+      // A row keeps the best of many candidates with few distinct scores
+      table.reset(7, 1);
+      ASSERT_EQ(table.rows(), 0u);
+      table.add_row();
+      std::vector<std::pair<float, size_t>> all;
+      for (int index = 0; index < 200; ++index) {
+        float score = float((index * 37) % 11) / 10;
+        table.insert(0, score, size_t(index), &index);
+        all.push_back(std::make_pair(score, size_t(index)));
+      }
+      table.sort(0);
+      std::sort(all.rbegin(), all.rend());
+      ASSERT_EQ(table.size(0), 7u);
+      for (size_t k = 0; k < table.size(0); ++k) {
+        ASSERT_EQ(table.begin(0)[k].score, all[k].first);
+        ASSERT_EQ(table.begin(0)[k].index, all[k].second);
+        ASSERT_EQ(size_t(*table.correct(0, k)), all[k].second);
+      }
+    }
 } // namespace
@@ -0,0 +1,197 @@
+#include "gtest/gtest.h"
+#include "../src/utils/compression.h"
+
+#include <string>
+#include <vector>
+#include <boost/make_unique.hpp>
+
+#ifdef HAVE_XZLIB
+#include <lzma.h>
+#endif
+
+
+namespace {
+
+    class StringSink : public utils::ByteSink {
+
+    public:
+
+        explicit StringSink(std::string &out) : out_(out) {};
+
+        void write(const char *data, size_t size) override { out_.append(data, size); }
+
+        void flush() override {};
+
+        void finish() override {};
+
+    private:
+        std::string &out_;
+
+    };
+
+    class StringSource : public utils::ByteSource {
+
+    public:
+
+        // Hands out at most chunk bytes per read, like a pipe would
+        StringSource(std::string data, size_t chunk) : data_(std::move(data)), chunk_(chunk) {};
+
+        size_t read(char *to, size_t amount) override {
+          size_t n = std::min(std::min(amount, chunk_), data_.size() - pos_);
+          data_.copy(to, n, pos_);
+          pos_ += n;
+          return n;
+        }
+
+    private:
+        std::string data_;
+        size_t chunk_;
+        size_t pos_ = 0;
+
+    };
+
+    std::string Compress(utils::Compression type, const std::vector<std::string> &writes, size_t threads) {
+      std::string out;
+      std::unique_ptr<utils::ByteSink> sink = utils::MakeCompressor(type, boost::make_unique<StringSink>(out),
+                                                                    threads);
+      for (auto &w : writes) {
+        sink->write(w.data(), w.size());
+        sink->flush();
+      }
+      sink->finish();
+      return out;
+    }
+
+    std::string Decompress(utils::Compression type, const std::string &data) {
+      std::unique_ptr<utils::ByteSource> source = utils::MakeDecompressor(
+              type, boost::make_unique<StringSource>(data, 7));
+      std::string out;
+      char buffer[100];
+      size_t n;
+      while ((n = source->read(buffer, sizeof(buffer))) > 0)
+        out.append(buffer, n);
+      return out;
+    }
+
+    std::vector<utils::Compression> CompiledFormats() {
+      std::vector<utils::Compression> formats = {utils::Compression::none};
+#ifdef HAVE_ZLIB
+      formats.push_back(utils::Compression::gzip);
+#endif
+#ifdef HAVE_ZSTD
+      formats.push_back(utils::Compression::zstd);
+#endif
+      return formats;
+    }
+
+    TEST(compression, test_round_trip) {
+      std::string large;
+      for (int i = 0; i < 200000; ++i)
+        large += "line " + std::to_string(i) + "\n";
+
+      std::vector<std::vector<std::string>> cases = {
+              {},
+              {"a\tb\n"},
+              {"first\n", "", "second\n", large, "last"},
+      };
+
+      for (utils::Compression type : CompiledFormats()) {
+        for (auto &writes : cases) {
+          std::string expected;
+          for (auto &w : writes)
+            expected += w;
+
+          for (size_t threads : {1, 3}) {
+            std::string compressed = Compress(type, writes, threads);
+            ASSERT_EQ(utils::DetectCompression(compressed.data(), compressed.size()),
+                      expected.empty() && type == utils::Compression::none ? utils::Compression::none : type);
+            ASSERT_EQ(Decompress(type, compressed), expected);
+          }
+        }
+      }
+    }
+
+    TEST(compression, test_concatenated_streams) {
+      for (utils::Compression type : CompiledFormats()) {
+        std::string compressed = Compress(type, {"abc\n"}, 1) + Compress(type, {"def\n"}, 1);
+        ASSERT_EQ(Decompress(type, compressed), "abc\ndef\n");
+      }
+    }
+
+    TEST(compression, test_truncated) {
+      for (utils::Compression type : CompiledFormats()) {
+        if (type == utils::Compression::none)
+          continue;
+        std::string compressed = Compress(type, {"some text that gets compressed\n"}, 1);
+        compressed.resize(compressed.size() - 4);
+        ASSERT_THROW(Decompress(type, compressed), std::runtime_error);
+      }
+    }
+
+    TEST(compression, test_flush_keeps_blocks) {
+      // Interval flushes leave the partial block to be compressed as a whole
+      std::vector<std::string> writes;
+      std::string all;
+      for (int i = 0; i < 1000; ++i) {
+        writes.push_back("document " + std::to_string(i) + "\n");
+        all += writes.back();
+      }
+
+      for (utils::Compression type : CompiledFormats()) {
+        for (size_t threads : {1, 3}) {
+          std::string compressed = Compress(type, writes, threads);
+          ASSERT_EQ(Decompress(type, compressed), all);
+          if (type == utils::Compression::gzip) {
+            ASSERT_EQ(compressed, Compress(type, {all}, threads));
+          }
+        }
+      }
+    }
+
+#ifdef HAVE_XZLIB
+    // xz is only read, so the test input is encoded with liblzma directly
+    std::string CompressXz(const std::string &data) {
+      std::string out(lzma_stream_buffer_bound(data.size()), '\0');
+      size_t size = 0;
+      if (lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, nullptr, reinterpret_cast<const uint8_t *>(data.data()),
+                                  data.size(), reinterpret_cast<uint8_t *>(&out[0]), &size, out.size()) != LZMA_OK)
+        throw std::runtime_error("xz compression failed");
+      out.resize(size);
+      return out;
+    }
+
+    TEST(compression, test_xz) {
+      std::string large;
+      for (int i = 0; i < 200000; ++i)
+        large += "line " + std::to_string(i) + "\n";
+
+      for (const std::string &data : {std::string(), std::string("a\tb\n"), large}) {
+        std::string compressed = CompressXz(data);
+        ASSERT_EQ(utils::DetectCompression(compressed.data(), compressed.size()), utils::Compression::xz);
+        ASSERT_EQ(Decompress(utils::Compression::xz, compressed), data);
+      }
+
+      ASSERT_EQ(Decompress(utils::Compression::xz, CompressXz("abc\n") + CompressXz("def\n")), "abc\ndef\n");
+
+      std::string truncated = CompressXz("some text that gets compressed\n");
+      truncated.resize(truncated.size() - 4);
+      ASSERT_THROW(Decompress(utils::Compression::xz, truncated), std::runtime_error);
+    }
+#endif
+
+    TEST(compression, test_DetectCompression) {
+      ASSERT_EQ(utils::DetectCompression("\x1f\x8b\x08", 3), utils::Compression::gzip);
+      ASSERT_EQ(utils::DetectCompression("\xfd" "7zXZ\x00", 6), utils::Compression::xz);
+      ASSERT_EQ(utils::DetectCompression("\x28\xb5\x2f\xfd", 4), utils::Compression::zstd);
+      ASSERT_EQ(utils::DetectCompression("url1\turl2", 9), utils::Compression::none);
+      ASSERT_EQ(utils::DetectCompression("\x1f", 1), utils::Compression::none);
+    }
+
+    TEST(compression, test_ParseCompression) {
+      ASSERT_EQ(utils::ParseCompression("gzip"), utils::Compression::gzip);
+      ASSERT_EQ(utils::ParseCompression("zstd"), utils::Compression::zstd);
+      ASSERT_EQ(utils::ParseCompression("none"), utils::Compression::none);
+      ASSERT_THROW(utils::ParseCompression("bzip2"), std::runtime_error);
+    }
+
+} // namespace
@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+#include "../src/utils/line_reader.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <boost/make_unique.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+
+    std::string WriteTempFile(const std::string &content) {
+      char name[] = "/tmp/bleualign_line_reader_XXXXXX";
+      int fd = mkstemp(name);
+      EXPECT_NE(fd, -1);
+      EXPECT_EQ(write(fd, content.data(), content.size()), ssize_t(content.size()));
+      close(fd);
+      return name;
+    }
+
+    std::vector<std::string> ReadAll(utils::LineReader &reader) {
+      std::vector<std::string> lines;
+      boost::string_ref line;
+      while (reader.read_line(line))
+        lines.push_back(line.to_string());
+      return lines;
+    }
+
+    TEST(line_reader, test_LineReader) {
+      std::string long_line(1000, 'x');
+      std::vector<std::pair<std::string, std::vector<std::string>>> cases = {
+              {"", {}},
+              {"\n", {""}},
+              {"a\nbc\n\nd", {"a", "bc", "", "d"}},
+              {"a\tb\n" + long_line + "\nc\n", {"a\tb", long_line, "c"}},
+      };
+
+      for (auto &c : cases) {
+        std::string name = WriteTempFile(c.first);
+
+        std::unique_ptr<utils::LineReader> mapped = utils::OpenLineReader(name);
+        ASSERT_TRUE(mapped->lines_persist());
+        ASSERT_EQ(ReadAll(*mapped), c.second);
+
+        // Small blocks so lines straddle reads and the buffer has to grow
+        int fd = open(name.c_str(), O_RDONLY);
+        utils::FdLineReader buffered(fd, name, true, 3);
+        ASSERT_EQ(ReadAll(buffered), c.second);
+
+        std::remove(name.c_str());
+      }
+    }
+
+    // Hands out a string in small pieces and cannot seek, like a pipe or a decoder
+    class StringSource : public utils::ByteSource {
+
+    public:
+
+        explicit StringSource(const std::string &data) : data_(data) {};
+
+        size_t read(char *to, size_t amount) override {
+          size_t size = std::min<size_t>(std::min<size_t>(amount, 2), data_.size() - pos_);
+          data_.copy(to, size, pos_);
+          pos_ += size;
+          return size;
+        }
+
+    private:
+        std::string data_;
+        size_t pos_ = 0;
+
+    };
+
+    TEST(line_reader, test_skip_to) {
+      std::string content = "first\nsecond line\n\nfourth\nfifth";
+      std::string name = WriteTempFile(content);
+
+      std::vector<std::unique_ptr<utils::LineReader>> readers;
+      readers.push_back(utils::OpenLineReader(name));
+      readers.push_back(boost::make_unique<utils::FdLineReader>(open(name.c_str(), O_RDONLY), name, true, 4));
+      readers.push_back(boost::make_unique<utils::StreamLineReader>(boost::make_unique<StringSource>(content), 4));
+
+      for (std::unique_ptr<utils::LineReader> &reader : readers) {
+        boost::string_ref line;
+        ASSERT_EQ(reader->offset(), 0u);
+        ASSERT_TRUE(reader->read_line(line));
+        ASSERT_TRUE(reader->read_line(line));
+        uint64_t offset = reader->offset();
+        ASSERT_EQ(offset, 18u);
+        ASSERT_EQ(ReadAll(*reader), (std::vector<std::string>{"", "fourth", "fifth"}));
+        ASSERT_EQ(reader->offset(), content.size());
+      }
+
+      // A fresh reader continues where the offset points
+      for (size_t i = 0; i < 3; ++i) {
+        std::unique_ptr<utils::LineReader> reader;
+        if (i == 0)
+          reader = utils::OpenLineReader(name);
+        else if (i == 1)
+          reader = boost::make_unique<utils::FdLineReader>(open(name.c_str(), O_RDONLY), name, true, 4);
+        else
+          reader = boost::make_unique<utils::StreamLineReader>(boost::make_unique<StringSource>(content), 4);
+
+        reader->skip_to(19);
+        ASSERT_EQ(reader->offset(), 19u);
+        ASSERT_EQ(ReadAll(*reader), (std::vector<std::string>{"fourth", "fifth"}));
+        ASSERT_THROW(reader->skip_to(content.size() + 1), std::runtime_error);
+      }
+
+      std::remove(name.c_str());
+    }
+
+    TEST(line_reader, test_OpenLineReader_missing) {
+      ASSERT_THROW(utils::OpenLineReader("/nonexistent/bleualign/input"), std::runtime_error);
+    }
+
+} // namespace
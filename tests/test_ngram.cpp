@@ -2,6 +2,10 @@
 #include "gtest/gtest.h"
 #include "../src/ngram.h"
 
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
 #include <vector>
 
 
@@ -844,4 +848,166 @@ namespace {
 
     }
 
+    void ExpectSameCounts(const ngram::NGramCounter &actual, const ngram::NGramCounter &expected, unsigned short n) {
+      ASSERT_EQ(actual.processed(), expected.processed());
+      ASSERT_EQ(actual.count_frequencies(), expected.count_frequencies());
+      for (unsigned short order = 1; order <= n; ++order)
+        ASSERT_EQ(ngram::ngram_vector(actual.cbegin(order), actual.cend(order)),
+                  ngram::ngram_vector(expected.cbegin(order), expected.cend(order)));
+    }
+
+    TEST(ngram, test_NGramCounter_append) {
+      // Few distinct tokens, so that n-grams repeat across the boundaries
+      std::vector<uint64_t> tokens;
+      for (size_t i = 0; i < 12; ++i)
+        tokens.push_back(ngram::get_token_hash(std::string(1, char('a' + (i * 7) % 3))));
+
+      for (unsigned short n = 1; n <= 4; ++n) {
+        for (size_t split1 = 0; split1 <= tokens.size(); ++split1) {
+          for (size_t split2 = split1; split2 <= tokens.size(); ++split2) {
+            ngram::NGramCounter expected(n);
+            expected.process(tokens.data(), tokens.data() + tokens.size());
+
+            ngram::NGramCounter a(n), b(n), c(n);
+            a.process(tokens.data(), tokens.data() + split1);
+            b.process(tokens.data() + split1, tokens.data() + split2);
+            c.process(tokens.data() + split2, tokens.data() + tokens.size());
+
+            // Growing to the right and to the left
+            ngram::NGramCounter prefix(a);
+            prefix.append(b);
+            prefix.append(c);
+            ExpectSameCounts(prefix, expected, n);
+
+            ngram::NGramCounter suffix(b);
+            suffix.append(c);
+            ngram::NGramCounter all(a);
+            all.append(suffix);
+            ExpectSameCounts(all, expected, n);
+          }
+        }
+      }
+    }
+
+    TEST(ngram, test_DocumentNGramIndex) {
+      std::vector<std::vector<std::string>> sentences = {
+              {"the", "cat", "and", "the", "cat"},
+              {},
+              {"a", "dog"},
+              {"the", "cat", "sat", "on", "the", "mat", "the", "cat"}};
+
+      std::vector<std::vector<uint64_t>> tokens(sentences.size());
+      for (size_t i = 0; i < sentences.size(); ++i)
+        for (const std::string &token : sentences[i])
+          tokens[i].push_back(ngram::get_token_hash(token));
+
+      // Filling it again after clear gives the same slices
+      ngram::DocumentNGramIndex index(3);
+      for (int round = 0; round < 2; ++round) {
+        index.clear();
+        for (const std::vector<uint64_t> &sentence : tokens)
+          index.add(sentence.data(), sentence.data() + sentence.size());
+
+        ASSERT_EQ(index.order(), 3);
+        ASSERT_EQ(index.size(), sentences.size());
+        for (size_t i = 0; i < sentences.size(); ++i) {
+          ngram::NGramCounter counter(3);
+          counter.process(tokens[i].data(), tokens[i].data() + tokens[i].size());
+          ASSERT_EQ(index.processed(i), tokens[i].size());
+
+          for (unsigned short order = 1; order <= 3; ++order) {
+            std::vector<std::pair<uint32_t, uint32_t>> expected;
+            for (auto it = counter.cbegin(order); it != counter.cend(order); ++it)
+              expected.push_back(std::make_pair(uint32_t(it->first >> 32), uint32_t(it->second)));
+
+            std::vector<std::pair<uint32_t, uint32_t>> actual;
+            const uint32_t *counts = index.counts_begin(i, order);
+            for (const uint32_t *key = index.keys_begin(i, order); key != index.keys_end(i, order); ++key, ++counts)
+              actual.push_back(std::make_pair(*key, *counts));
+            ASSERT_EQ(actual, expected);
+          }
+        }
+      }
+    }
+
+    TEST(ngram, test_InvertedNGramIndex) {
+      std::vector<std::vector<std::string>> sentences = {
+              {"the", "cat", "sat"},
+              {"a", "dog"},
+              {"the", "cat", "and", "the", "cat"},
+              {}};
+
+      ngram::DocumentNGramIndex index(2);
+      for (const std::vector<std::string> &sentence : sentences) {
+        std::vector<uint64_t> tokens;
+        for (const std::string &token : sentence)
+          tokens.push_back(ngram::get_token_hash(token));
+        index.add(tokens.data(), tokens.data() + tokens.size());
+      }
+
+      for (unsigned short order = 1; order <= 2; ++order) {
+        ngram::InvertedNGramIndex inverted(index, order);
+        for (size_t i = 0; i < index.size(); ++i) {
+          for (const uint32_t *key = index.keys_begin(i, order); key != index.keys_end(i, order); ++key) {
+            std::vector<uint32_t> expected;
+            for (size_t j = 0; j < index.size(); ++j)
+              if (std::binary_search(index.keys_begin(j, order), index.keys_end(j, order), *key))
+                expected.push_back(uint32_t(j));
+
+            std::pair<const uint32_t *, const uint32_t *> postings = inverted.postings(*key);
+            ASSERT_EQ(std::vector<uint32_t>(postings.first, postings.second), expected);
+          }
+        }
+      }
+
+      ngram::InvertedNGramIndex inverted(index, 1);
+      std::pair<const uint32_t *, const uint32_t *> postings =
+              inverted.postings(uint32_t(ngram::get_token_hash("bird") >> 32));
+      ASSERT_EQ(postings.first, postings.second);
+    }
+
+    TEST(ngram, test_intersect_counts) {
+      // Keys from a small range so that sets overlap, with sizes around the
+      // block size and skewed enough to gallop
+      std::mt19937 random(7);
+      std::vector<std::pair<size_t, size_t>> sizes;
+      for (size_t lsize = 0; lsize <= 13; ++lsize)
+        for (size_t rsize = 0; rsize <= 13; ++rsize)
+          sizes.push_back(std::make_pair(lsize, rsize));
+      sizes.push_back(std::make_pair(2, 100));
+      sizes.push_back(std::make_pair(150, 5));
+      sizes.push_back(std::make_pair(60, 60));
+
+      for (const std::pair<size_t, size_t> &size : sizes) {
+        for (int round = 0; round < 20; ++round) {
+          std::map<uint32_t, uint32_t> left, right;
+          while (left.size() < size.first)
+            left[random() % 300] = random() % 4 + 1;
+          while (right.size() < size.second)
+            right[random() % 300] = random() % 4 + 1;
+
+          uint32_t expected = 0;
+          for (const std::pair<const uint32_t, uint32_t> &key : left)
+            if (right.count(key.first))
+              expected += std::min(key.second, right[key.first]);
+
+          std::vector<uint32_t> lkeys, lcounts, rkeys, rcounts;
+          for (const std::pair<const uint32_t, uint32_t> &key : left) {
+            lkeys.push_back(key.first);
+            lcounts.push_back(key.second);
+          }
+          for (const std::pair<const uint32_t, uint32_t> &key : right) {
+            rkeys.push_back(key.first);
+            rcounts.push_back(key.second);
+          }
+
+          ASSERT_EQ(ngram::intersect_counts(lkeys.data(), lkeys.data() + lkeys.size(), lcounts.data(),
+                                            rkeys.data(), rkeys.data() + rkeys.size(), rcounts.data()), expected);
+          ASSERT_EQ(ngram::intersect_counts_scalar(lkeys.data(), lkeys.data() + lkeys.size(), lcounts.data(),
+                                                   rkeys.data(), rkeys.data() + rkeys.size(), rcounts.data()),
+                    expected);
+        }
+      }
+    }
+
 } // namespace
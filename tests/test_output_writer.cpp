@@ -0,0 +1,60 @@
+#include "gtest/gtest.h"
+#include "../src/utils/output_writer.h"
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <limits>
+
+
+namespace {
+
+    std::string StreamFixed6(double value) {
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(6) << value;
+      return ss.str();
+    }
+
+    TEST(output_writer, test_AppendFixed6) {
+      std::vector<double> values = {0.0, -0.0, 1.0, 0.5, 0.0000005, 0.0000015, 0.0000025, 0.623753, 0.999999951,
+                                    1e-12, 12345.6789, -0.25, 1e20, std::numeric_limits<double>::quiet_NaN(),
+                                    std::numeric_limits<double>::infinity(), 0.1, 1.0 / 3.0};
+
+      std::mt19937 rng(1);
+      std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+      for (size_t i = 0; i < 100000; ++i)
+        values.push_back(unit(rng));
+
+      // Values on the rounding boundary of the sixth decimal
+      for (int i = 0; i < 2000; ++i) {
+        values.push_back(float((i + 0.5) / 1e6));
+        values.push_back(std::nextafter(float((i + 0.5) / 1e6), 1.0f));
+        values.push_back(std::nextafter(float((i + 0.5) / 1e6), 0.0f));
+      }
+
+      std::string out;
+      for (double value : values) {
+        out.clear();
+        utils::AppendFixed6(out, value);
+        ASSERT_EQ(out, StreamFixed6(value)) << "value " << std::setprecision(20) << value;
+      }
+    }
+
+    TEST(output_writer, test_AppendHex) {
+      std::mt19937_64 rng(2);
+      std::vector<uint64_t> values = {0, 1, 15, 16, 0xffffffffffffffffULL, 0x8000000000000000ULL};
+      for (size_t i = 0; i < 1000; ++i)
+        values.push_back(rng() >> (i % 64));
+
+      std::string out;
+      for (uint64_t value : values) {
+        out.clear();
+        utils::AppendHex(out, value);
+        std::ostringstream ss;
+        ss << std::hex << value;
+        ASSERT_EQ(out, ss.str());
+      }
+    }
+
+} // namespace
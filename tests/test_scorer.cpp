@@ -2,6 +2,8 @@
 #include "gtest/gtest.h"
 #include "../src/scorer.h"
 
+#include <random>
+
 
 using namespace scorer;
 
@@ -80,6 +82,161 @@ namespace {
     }
 
 
+    // The reference Tokenize is checked against: split on every match of
+    // tokenize_regex, keeping the separators except spaces
+    void RegexTokenize(std::vector<std::string> &token_vec, const std::string &text) {
+      token_vec.clear();
+
+      boost::sregex_iterator it(text.begin(), text.end(), tokenize_regex);
+      boost::sregex_iterator end;
+      size_t last_pos = 0;
+
+      for (; it != end; ++it) {
+        std::string token = text.substr(last_pos, it->position() - last_pos);
+
+        if (token.length() > 0) {
+          token_vec.push_back(token);
+        }
+        if (it->str() != " ") {
+          token_vec.push_back(it->str());
+        }
+
+        last_pos = it->position() + it->str().length();
+      }
+
+      if (last_pos < text.length()) {
+        token_vec.push_back(text.substr(last_pos, text.length() - last_pos));
+      }
+    }
+
+    TEST(scorer, test_Tokenize_regex) {
+      std::vector<std::string> texts = {
+              "", " ", ".", "-", "1-", "-1", "1.", ".1", "1.1", "1,1", "a.1", "1.a", "1-1-1", "1--1", "1..1", "1.,1",
+              " with friends and guests share them if need be her last bit bread . ",
+              " more than 3-000-000 albanians (~2.5 million) @ kosovo, but also in macedonia. ",
+              "BOEING 777-200 - 280 SEATS.Characteristics Length in meters: 63.70 Mach .84 10 700 m / 35 000 ft",
+              "it's {a} [b] \\c\\ ^d_ `e` \"f\" #g$ %h& *i+ ;j< =k> ?l@ |m} ~n\ttab",
+              "Home \xc2\xbb Country \xe2\x80\x94 People 1\xc2\xbd-2 \xe4\xb8\xad\xe6\x96\x87\xe3\x80\x82",
+      };
+
+      // Random strings over the characters the rules distinguish
+      const std::string alphabet = "0123456789.,-' ab/\t\x7f\xc3\xa9{}[]`~&(+:@";
+      std::mt19937 random(42);
+      for (size_t i = 0; i < 5000; ++i) {
+        std::string text(random() % 12, ' ');
+        for (char &c : text)
+          c = alphabet[random() % alphabet.size()];
+        texts.push_back(text);
+      }
+      std::string all_bytes;
+      for (int c = 1; c < 256; ++c)
+        all_bytes.append(1, char(c)).append(1, '1').append(1, char(c));
+      texts.push_back(all_bytes);
+
+      std::vector<std::string> expected, token_vec;
+      std::vector<uint64_t> token_hashes;
+      for (const std::string &text : texts) {
+        RegexTokenize(expected, text);
+        scorer::Tokenize(token_vec, text);
+        ASSERT_EQ(token_vec, expected) << "text: " << text;
+
+        scorer::Tokenize(token_hashes, text);
+        ASSERT_EQ(token_hashes.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+          ASSERT_EQ(token_hashes[i], ngram::get_token_hash(expected[i]));
+      }
+    }
+
+
+    TEST(scorer, test_Normalizer_rules) {
+      std::vector<std::string> texts = {
+              "", "&", "&amp;", "&amp;amp;", "&amp;lt;", "&amp;quot;x", "&&lt;;", "&lt", "&quot&quot;",
+              "<skipped>", "<skip<skipped>ped>", "-<skipped>\n", "--\n\n", "a-\nb\nc-", "-&amp;\n",
+              "Price: 1,299.00 EUR &quot;incl. VAT&quot; -\nshipping &lt;2 days&gt; <skipped> ETE",
+      };
+
+      // Random strings over the bytes of the patterns
+      const std::string alphabet = "<skiped>-\n&amltgquo;A ";
+      std::mt19937 random(7);
+      for (size_t i = 0; i < 20000; ++i) {
+        std::string text(random() % 16, ' ');
+        for (char &c : text)
+          c = alphabet[random() % alphabet.size()];
+        texts.push_back(text);
+      }
+
+      scorer::Normalizer western("western");
+      scorer::Normalizer other("other");
+      for (const std::string &text : texts) {
+        std::string expected = ApplyNormalizeRules(ApplyNormalizeRules(text, normalize1_rules), normalize2_rules);
+        ASSERT_EQ(other(text), expected) << "text: " << text;
+
+        for (char &c : expected)
+          if (c >= 'A' && c <= 'Z')
+            c = char(c - 'A' + 'a');
+        ASSERT_EQ(western(text), " " + expected + " ") << "text: " << text;
+      }
+    }
+
+
+    TEST(scorer, test_Normalizer_case) {
+      std::vector<std::pair<std::string, std::string>> cases = {
+              {"ABCDEFGHIJKLMNOPQRSTUVWXYZ @[`{ Mixed Case", "abcdefghijklmnopqrstuvwxyz @[`{ mixed case"},
+              {"\xc3\x89T\xc3\x89 \xc3\x80 LA PLAGE", "\xc3\xa9t\xc3\xa9 \xc3\xa0 la plage"},
+              {"\xd0\x9c\xd0\x9e\xd0\xa1\xd0\x9a\xd0\x92\xd0\x90", "\xd0\xbc\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0"},
+              // Greek final sigma folds like the capital
+              {"\xce\x9f\xce\x94\xce\x9f\xce\xa3 \xce\xbf\xce\xb4\xce\xbf\xcf\x82", "\xce\xbf\xce\xb4\xce\xbf\xcf\x83 \xce\xbf\xce\xb4\xce\xbf\xcf\x83"},
+              {"STRA\xc3\x9f" "E", "stra\xc3\x9f" "e"},
+              // Kelvin sign folds to ASCII
+              {"\xe2\x84\xaa", "k"},
+              {"\xe4\xb8\xad\xe6\x96\x87 &amp; \xf0\x9f\x98\x80", "\xe4\xb8\xad\xe6\x96\x87 & \xf0\x9f\x98\x80"},
+              // Invalid UTF-8 is kept as it is
+              {"\xc3( \xc0\xaf \xed\xa0\x80 \xff A\xc3", "\xc3( \xc0\xaf \xed\xa0\x80 \xff a\xc3"},
+              {"\xe2\x82", "\xe2\x82"},
+      };
+
+      scorer::Normalizer western("western");
+      scorer::Normalizer other("other");
+      for (auto &c : cases) {
+        ASSERT_EQ(western(c.first), " " + c.second + " ") << "text: " << c.first;
+        ASSERT_EQ(other(c.first), ApplyNormalizeRules(c.first, normalize2_rules)) << "text: " << c.first;
+      }
+    }
+
+
+    TEST(scorer, test_normalize_cjk) {
+      std::vector<std::pair<std::string, std::vector<std::string>>> cases = {
+              // 中文ABC。日本語です
+              {"\xe4\xb8\xad\xe6\x96\x87" "ABC\xe3\x80\x82\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xa7\xe3\x81\x99",
+               {"\xe4\xb8\xad", "\xe6\x96\x87", "abc", "\xe3\x80\x82", "\xe6\x97\xa5", "\xe6\x9c\xac",
+                "\xe8\xaa\x9e", "\xe3\x81\xa7", "\xe3\x81\x99"}},
+              // Thai vowel and tone marks stay with their consonant: กินข้าว
+              {"\xe0\xb8\x81\xe0\xb8\xb4\xe0\xb8\x99\xe0\xb8\x82\xe0\xb9\x89\xe0\xb8\xb2\xe0\xb8\xa7",
+               {"\xe0\xb8\x81\xe0\xb8\xb4", "\xe0\xb8\x99", "\xe0\xb8\x82\xe0\xb9\x89", "\xe0\xb8\xb2",
+                "\xe0\xb8\xa7"}},
+              // Other scripts and marks after them are left alone
+              {"Cafe\xcc\x81 &amp; \xd0\x9c\xd0\xb8\xd1\x80 2,5", {"cafe\xcc\x81", "&", "\xd0\xbc\xd0\xb8\xd1\x80", "2,5"}},
+      };
+
+      std::vector<std::string> token_vec;
+      std::vector<uint64_t> token_hashes;
+      scorer::Normalizer normalizer("cjk");
+      for (auto &c : cases) {
+        scorer::normalize(token_vec, c.first, "cjk");
+        ASSERT_EQ(token_vec, c.second) << "text: " << c.first;
+
+        scorer::normalize(token_hashes, c.first, normalizer);
+        ASSERT_EQ(token_hashes.size(), c.second.size());
+        for (size_t i = 0; i < token_hashes.size(); ++i)
+          ASSERT_EQ(token_hashes[i], ngram::get_token_hash(c.second[i]));
+      }
+
+      // Without the profile a run of Chinese is a single token
+      scorer::normalize(token_vec, cases[0].first, "western");
+      ASSERT_EQ(token_vec.size(), 1u);
+    }
+
+
     TEST(scorer, test_normalize) {
       std::vector<std::string> token_vec;
 
@@ -18,26 +18,25 @@ namespace {
               utils::match(2, 2, 2, 2, 0.0f),
       };
 
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(4., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(0., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(5., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+
+      scorelist.add_row();
+      scorelist.insert(0, 4., 0);
+      scorelist.insert(0, 1., 1);
+      scorelist.insert(0, 3., 2);
+      scorelist.sort(0);
+
+      scorelist.add_row();
+      scorelist.insert(1, 2., 0);
+      scorelist.insert(1, 0., 1);
+      scorelist.insert(1, 5., 2);
+      scorelist.sort(1);
+
+      scorelist.add_row();
+      scorelist.insert(2, 3., 0);
+      scorelist.insert(2, 2., 1);
+      scorelist.insert(2, 2., 2);
+      scorelist.sort(2);
 
       Munkres mm(3, 3);
       mm.process(scorelist);
@@ -60,29 +59,28 @@ namespace {
               utils::match(2, 2, 2, 2, 0.0f),
       };
 
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(4., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(2, dummy)));
-      smap.insert(utils::scoremap::value_type(5., std::make_pair(3, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(0., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(5., std::make_pair(2, dummy)));
-      smap.insert(utils::scoremap::value_type(0., std::make_pair(3, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(2, dummy)));
-      smap.insert(utils::scoremap::value_type(4., std::make_pair(3, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+
+      scorelist.add_row();
+      scorelist.insert(0, 4., 0);
+      scorelist.insert(0, 1., 1);
+      scorelist.insert(0, 3., 2);
+      scorelist.insert(0, 5., 3);
+      scorelist.sort(0);
+
+      scorelist.add_row();
+      scorelist.insert(1, 2., 0);
+      scorelist.insert(1, 0., 1);
+      scorelist.insert(1, 5., 2);
+      scorelist.insert(1, 0., 3);
+      scorelist.sort(1);
+
+      scorelist.add_row();
+      scorelist.insert(2, 3., 0);
+      scorelist.insert(2, 2., 1);
+      scorelist.insert(2, 2., 2);
+      scorelist.insert(2, 4., 3);
+      scorelist.sort(2);
 
       Munkres mm(3, 4);
       mm.process(scorelist);
@@ -105,32 +103,31 @@ namespace {
               utils::match(3, 3, 0, 0, 0.0f),
       };
 
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(4., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(0., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(5., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(3., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(2., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(1., std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+
+      scorelist.add_row();
+      scorelist.insert(0, 4., 0);
+      scorelist.insert(0, 1., 1);
+      scorelist.insert(0, 3., 2);
+      scorelist.sort(0);
+
+      scorelist.add_row();
+      scorelist.insert(1, 2., 0);
+      scorelist.insert(1, 0., 1);
+      scorelist.insert(1, 5., 2);
+      scorelist.sort(1);
+
+      scorelist.add_row();
+      scorelist.insert(2, 3., 0);
+      scorelist.insert(2, 2., 1);
+      scorelist.insert(2, 2., 2);
+      scorelist.sort(2);
+
+      scorelist.add_row();
+      scorelist.insert(3, 1., 0);
+      scorelist.insert(3, 1., 1);
+      scorelist.insert(3, 1., 2);
+      scorelist.sort(3);
 
       Munkres mm(4, 3);
       mm.process(scorelist);
@@ -315,11 +312,10 @@ namespace {
       utils::matches_vec matches = {
               utils::match(0, 0, 0, 0, 0.0f),
       };
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(0, std::make_pair(0, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+      scorelist.add_row();
+      scorelist.insert(0, 0, 0);
+      scorelist.sort(0);
 
       search::FilterMatches(matches, scorelist);
 
@@ -332,11 +328,10 @@ namespace {
       utils::matches_vec matches = {
               utils::match(0, 0, 0, 0, 0.0),
       };
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(0.5, std::make_pair(0, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+      scorelist.add_row();
+      scorelist.insert(0, 0.5, 0);
+      scorelist.sort(0);
 
       search::FilterMatches(matches, scorelist);
 
@@ -356,23 +351,22 @@ namespace {
               utils::match(2, 2, 2, 2, 0.0),
       };
 
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(0.71, std::make_pair(0, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+      scorelist.add_row();
+      scorelist.insert(0, 0.71, 0);
+      scorelist.sort(0);
 
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(0, std::make_pair(1, dummy)));
-      scorelist.push_back(smap);
+      scorelist.add_row();
+      scorelist.insert(1, 0, 1);
+      scorelist.sort(1);
 
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(0.72, std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
+      scorelist.add_row();
+      scorelist.insert(2, 0.72, 2);
+      scorelist.sort(2);
 
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(0.6, std::make_pair(0, dummy)));
-      scorelist.push_back(smap);
+      scorelist.add_row();
+      scorelist.insert(3, 0.6, 0);
+      scorelist.sort(3);
 
       search::FilterMatches(matches, scorelist, 0.71);
 
@@ -391,26 +385,25 @@ namespace {
               utils::match(2, 2, 2, 2, 0.0),
       };
 
-      std::vector<utils::scoremap> scorelist;
-      std::vector<int> dummy;
-
-      utils::scoremap smap;
-      smap.insert(utils::scoremap::value_type(.1, std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(.9, std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(.5, std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(.2, std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(.1, std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(.3, std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
-
-      smap.clear();
-      smap.insert(utils::scoremap::value_type(.3, std::make_pair(0, dummy)));
-      smap.insert(utils::scoremap::value_type(.4, std::make_pair(1, dummy)));
-      smap.insert(utils::scoremap::value_type(.8, std::make_pair(2, dummy)));
-      scorelist.push_back(smap);
+      utils::CandidateTable scorelist(4);
+
+      scorelist.add_row();
+      scorelist.insert(0, .1, 0);
+      scorelist.insert(0, .9, 1);
+      scorelist.insert(0, .5, 2);
+      scorelist.sort(0);
+
+      scorelist.add_row();
+      scorelist.insert(1, .2, 0);
+      scorelist.insert(1, .1, 1);
+      scorelist.insert(1, .3, 2);
+      scorelist.sort(1);
+
+      scorelist.add_row();
+      scorelist.insert(2, .3, 0);
+      scorelist.insert(2, .4, 1);
+      scorelist.insert(2, .8, 2);
+      scorelist.sort(2);
 
       Dynamic dd(3, 3);
       dd.process(scorelist);
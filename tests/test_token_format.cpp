@@ -0,0 +1,167 @@
+#include "gtest/gtest.h"
+#include "../src/utils/token_format.h"
+#include "../src/scorer.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+
+namespace {
+
+    // Serves the records of a string like TokenRecordReader does
+    class RecordReader : public utils::LineReader {
+
+    public:
+
+        explicit RecordReader(const std::string &data) : data_(data), pos_(8) {};
+
+        bool read_line(boost::string_ref &record) override {
+          if (pos_ == data_.size())
+            return false;
+          size_t size = 0;
+          for (size_t i = 0; i < 4; ++i)
+            size |= size_t(uint8_t(data_[pos_ + i])) << (8 * i);
+          record = boost::string_ref(data_.data() + pos_ + 4, size);
+          pos_ += 4 + size;
+          return true;
+        }
+
+        bool lines_persist() const override { return true; }
+
+        uint64_t offset() const override { return pos_; }
+
+        void skip_to(uint64_t offset) override { pos_ = offset; }
+
+    private:
+        std::string data_;
+        size_t pos_;
+
+    };
+
+    utils::DocumentPair MakeDocumentPair() {
+      utils::DocumentPair doc_pair;
+      doc_pair.url1 = "http://a.example/de";
+      doc_pair.url2 = "http://b.example/en";
+      doc_pair.text1 = std::vector<std::string>{"Hallo Welt.", "", "Zweiter Satz"};
+      doc_pair.text2 = std::vector<std::string>{"Hello world.", "Second sentence"};
+      doc_pair.text1translated = std::vector<std::string>{"Hello world.", "", "Second sentence"};
+      scorer::normalize(doc_pair.text1tokens, doc_pair.text1translated, "western");
+      scorer::normalize(doc_pair.text2tokens, doc_pair.text2, "western");
+      doc_pair.text1metadata = {{"1", "x"}, {"2", ""}, {"3", "z"}};
+      doc_pair.text2metadata = {{"4", "u"}, {"5", "v"}};
+      return doc_pair;
+    }
+
+    TEST(token_format, test_round_trip) {
+      utils::TokenFileHeader header;
+      header.metadata_fields = {"id", "note"};
+
+      utils::DocumentPair doc_pair = MakeDocumentPair();
+      std::string data;
+      utils::WriteTokenHeader(data, header);
+      utils::WriteTokenRecord(data, doc_pair, header);
+
+      RecordReader in(data);
+      utils::TokenFileHeader read_header = utils::ReadTokenHeader(in);
+      ASSERT_EQ(read_header.version, 2u);
+      ASSERT_EQ(read_header.normalizer, "western");
+      ASSERT_EQ(read_header.metadata_fields, header.metadata_fields);
+
+      boost::string_ref record;
+      ASSERT_TRUE(in.read_line(record));
+
+      for (bool metadata : {false, true}) {
+        utils::DocumentPair read;
+        utils::ReadTokenRecord(read, record, 1, read_header, metadata);
+
+        ASSERT_TRUE(read.pretokenized);
+        ASSERT_EQ(read.url1, doc_pair.url1);
+        ASSERT_EQ(read.url2, doc_pair.url2);
+        ASSERT_EQ(std::vector<boost::string_ref>(read.text1.begin(), read.text1.end()),
+                  std::vector<boost::string_ref>(doc_pair.text1.begin(), doc_pair.text1.end()));
+        ASSERT_EQ(std::vector<boost::string_ref>(read.text2.begin(), read.text2.end()),
+                  std::vector<boost::string_ref>(doc_pair.text2.begin(), doc_pair.text2.end()));
+
+        ASSERT_EQ(read.text1tokens.size(), 3u);
+        ASSERT_EQ(read.text1tokens.sentence_size(1), 0u);
+        for (size_t i = 0; i < read.text1tokens.size(); ++i)
+          ASSERT_TRUE(std::equal(read.text1tokens.sentence_begin(i), read.text1tokens.sentence_end(i),
+                                 doc_pair.text1tokens.sentence_begin(i)));
+
+        if (metadata) {
+          ASSERT_EQ(read.text1metadata, doc_pair.text1metadata);
+          ASSERT_EQ(read.text2metadata, doc_pair.text2metadata);
+        } else {
+          ASSERT_TRUE(read.text1metadata.empty());
+        }
+      }
+
+      ASSERT_FALSE(in.read_line(record));
+    }
+
+    TEST(token_format, test_invalid) {
+      utils::TokenFileHeader header;
+      utils::DocumentPair doc_pair = MakeDocumentPair();
+      std::string data;
+      utils::WriteTokenRecord(data, doc_pair, header);
+      boost::string_ref record(data.data() + 4, data.size() - 4);
+
+      utils::DocumentPair read;
+      ASSERT_THROW(utils::ReadTokenRecord(read, record.substr(0, record.size() - 3), 1, header, false),
+                   std::runtime_error);
+
+      // Metadata promised by the header but missing from the record
+      header.metadata_fields = {"id"};
+      ASSERT_THROW(utils::ReadTokenRecord(read, record, 1, header, true), std::runtime_error);
+
+      // Empty urls and texts, then a sentence of 2^61 tokens, whose size in
+      // bytes wraps around to 0
+      std::string corrupt(4, '\0');
+      corrupt += '\1';
+      for (uint64_t count = uint64_t(1) << 61; count >= 0x80; count >>= 7)
+        corrupt += char(0x80 | (count & 0x7f));
+      corrupt += char((uint64_t(1) << 61) >> 56);
+      header.metadata_fields.clear();
+      ASSERT_THROW(utils::ReadTokenRecord(read, corrupt, 1, header, false), std::runtime_error);
+    }
+
+    TEST(token_format, test_old_version) {
+      utils::TokenFileHeader header;
+      header.version = 1;
+      std::string data;
+      utils::WriteTokenHeader(data, header);
+
+      RecordReader in(data);
+      ASSERT_THROW(utils::ReadTokenHeader(in), std::runtime_error);
+    }
+
+    TEST(token_format, test_OpenTokenReader) {
+      utils::TokenFileHeader header;
+      std::string data;
+      utils::WriteTokenHeader(data, header);
+      utils::WriteTokenRecord(data, MakeDocumentPair(), header);
+
+      char name[] = "/tmp/bleualign_token_format_XXXXXX";
+      int fd = mkstemp(name);
+      ASSERT_NE(fd, -1);
+      ASSERT_EQ(write(fd, data.data(), data.size()), ssize_t(data.size()));
+      close(fd);
+
+      std::unique_ptr<utils::LineReader> in = utils::OpenTokenReader(name);
+      utils::ReadTokenHeader(*in);
+      boost::string_ref record;
+      ASSERT_TRUE(in->read_line(record));
+      utils::DocumentPair read;
+      utils::ReadTokenRecord(read, record, 1, header, false);
+      ASSERT_EQ(read.url2, "http://b.example/en");
+      ASSERT_FALSE(in->read_line(record));
+      std::remove(name);
+
+      ASSERT_THROW(utils::OpenTokenReader("/nonexistent/bleualign/input"), std::runtime_error);
+    }
+
+} // namespace
@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include "../src/utils/tsv_format.h"
+
+#include <string>
+#include <vector>
+
+
+namespace {
+
+    TEST(tsv_format, test_GetField) {
+      std::vector<std::string> lines = {"", "a", "a\tb\tc", "\t\tc\t", "url1\turl2\tYQ==\tYg=="};
+
+      for (const std::string &line : lines) {
+        std::vector<std::string> fields;
+        utils::SplitString(fields, line, '\t');
+        ASSERT_EQ(utils::CountFields(line), fields.size());
+
+        for (size_t i = 0; i < fields.size() + 2; ++i)
+          ASSERT_EQ(utils::GetField(line, i), i < fields.size() ? fields[i] : std::string());
+      }
+    }
+
+    TEST(tsv_format, test_ReadOutputColumns) {
+      std::unordered_map<std::string, int> header_idxs = {
+              {"src_url", 0}, {"trg_url", 1}, {"src_text", 2}, {"trg_text", 3}, {"src_translated", 4}};
+      std::vector<std::string> mandatory = utils::GetMandatoryHeaderFields({});
+
+      // src_text is not base64, which only matters once the output columns are
+      // decoded. "YQpi" is "a\nb", "Yw==" is "c" and "ZA==" is "d".
+      std::string line = "url1\turl2\t!!!!\tYQpi\tYw==";
+      utils::DocumentPair doc_pair;
+      std::vector<boost::string_ref> split_line;
+      utils::ReadScoringColumns(doc_pair, split_line, line, 1, 5, header_idxs, mandatory);
+      ASSERT_EQ(doc_pair.url2, "url2");
+      ASSERT_EQ(doc_pair.text1translated.size(), 1u);
+      ASSERT_EQ(doc_pair.translated_text2().size(), 2u);
+      ASSERT_THROW(utils::ReadOutputColumns(doc_pair, split_line, 1, header_idxs, {}), std::runtime_error);
+
+      std::string valid = "url1\turl2\tZA==\tYQpi\tYw==";
+      utils::ReadDocumentPair(doc_pair, split_line, valid, 2, 5, header_idxs, mandatory, {});
+      ASSERT_EQ(doc_pair.text1[0], "d");
+
+      // The translation must have as many lines as the text
+      header_idxs["trg_translated"] = 5;
+      std::string mismatch = "url1\turl2\tZA==\tYQpi\tYw==\tYw==";
+      utils::ReadScoringColumns(doc_pair, split_line, mismatch, 3, 6, header_idxs, mandatory);
+      ASSERT_THROW(utils::ReadOutputColumns(doc_pair, split_line, 3, header_idxs, {}), std::runtime_error);
+    }
+
+} // namespace